@@ -9,4 +9,14 @@
 #include "winmenu/stdint.hpp"
 #include "winmenu/Usage.hpp"
 #include "winmenu/WinError.hpp"
+#include "winmenu/Status.hpp"
+#include "winmenu/Sketch.hpp"
+#include "winmenu/Aggregator.hpp"
+#include "winmenu/Encoder.hpp"
+#include "winmenu/RegWriter.hpp"
+#include "winmenu/TimeIndex.hpp"
+#include "winmenu/Snapshot.hpp"
+#include "winmenu/MappedFile.hpp"
+#include "winmenu/Hive.hpp"
+#include "winmenu/WineRegistry.hpp"
 #endif // WINAPPUSAGE_HPP
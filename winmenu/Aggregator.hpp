@@ -0,0 +1,249 @@
+/**
+ * @author    Dmitry Selyutin
+ * @copyright GNU General Public License v3.0+
+ */
+
+#ifndef WINAPPUSAGE_AGGREGATOR_HPP
+#define WINAPPUSAGE_AGGREGATOR_HPP
+#include "config.hpp"
+#include "stdint.hpp"
+#include "Sketch.hpp"
+#include "Usage.hpp"
+namespace winmenu {
+
+
+/**
+ * @brief Fixed memory aggregation of launch counters across many profiles.
+ *
+ * Aggregator is not thread-safe: every thread should fill its own object
+ * and merge it into the shared one afterwards. Aggregators from different
+ * hosts are exchanged via serialize and deserialize and then merged; all
+ * parties must use the same parameters and seed.
+ */
+class Aggregator
+{
+private: // PRIVATE MEMBERS
+  uint64_t self_seed;
+  uint64_t self_entries;
+  CountMin self_counter;
+  SpaceSaving self_heavy;
+  HyperLogLog self_distinct;
+
+
+public: // PUBLIC TYPES
+  typedef SpaceSaving::Entry Entry;
+
+
+public: // CLASS FUNCTIONS
+  /**
+   * @param capacity number of heavy hitters to track
+   * @param width count-min sketch width
+   * @param depth count-min sketch depth
+   * @param precision HyperLogLog precision
+   * @param seed hash seed shared by all sketches
+   */
+  Aggregator(const size_t& capacity = 256,
+             const size_t& width = 2048,
+             const size_t& depth = 4,
+             const uint32_t& precision = 14,
+             const uint64_t& seed = 0)
+  : self_seed(seed)
+  , self_entries(0)
+  , self_counter(width, depth, seed)
+  , self_heavy(capacity, seed)
+  , self_distinct(precision, seed)
+  {
+  }
+
+
+  /**
+   * @brief Add launch counter of the single file.
+   */
+  void
+  add(const wchar_t* name,
+      const uint64_t& counter)
+  {
+    const uint64_t code = Sketch::hash(name, self_seed);
+    self_distinct.add_hash(code);
+    ++self_entries;
+    if (counter == 0)
+      return;
+    self_counter.add_hash(code, counter);
+    self_heavy.add_hash(name, code, counter, 0);
+  }
+
+
+  /**
+   * @brief Add all entries decoded by Usage.
+   */
+  void
+  add(const Usage& usage)
+  {
+    const size_t size = usage.size();
+    for (size_t i = 0; i < size; ++i)
+    {
+      const int32_t counter = usage.counter(i);
+      this->add(usage.name(i), (counter > 0) ? counter : 0);
+    }
+  }
+
+
+  /**
+   * @brief Estimate total launch counter of the given file.
+   */
+  inline uint64_t
+  estimate(const wchar_t* name) const
+  {
+    return self_counter.estimate(name);
+  }
+
+
+  /**
+   * @brief Retrieve up to count most used files.
+   *
+   * Real counter of each file lies within [count - error, count].
+   */
+  inline void
+  top(const size_t& count,
+      std::vector<Entry>& result) const
+  {
+    self_heavy.top(count, result);
+    for (size_t i = 0; i < result.size(); ++i)
+    {
+      // Count-min sketch may provide the tighter upper bound.
+      Entry& entry = result[i];
+      const uint64_t estimate = self_counter.estimate_hash(entry.hash);
+      if (estimate < entry.count)
+      {
+        const uint64_t delta = (entry.count - estimate);
+        entry.count = estimate;
+        entry.error = ((entry.error > delta) ? (entry.error - delta) : 0);
+      }
+    }
+  }
+
+
+  /**
+   * @brief Estimate number of distinct files.
+   */
+  inline double
+  distinct() const
+  {
+    return self_distinct.estimate();
+  }
+
+
+  /**
+   * @brief Sum of all launch counters.
+   */
+  inline uint64_t
+  total() const
+  {
+    return self_counter.total();
+  }
+
+
+  /**
+   * @brief Number of entries added, including duplicates.
+   */
+  inline uint64_t
+  entries() const
+  {
+    return self_entries;
+  }
+
+
+  /**
+   * @brief Merge another aggregator into this one.
+   *
+   * @return false if aggregators have incompatible parameters
+   */
+  bool
+  merge(const Aggregator& other)
+  {
+    if (self_seed != other.self_seed)
+      return false;
+    CountMin counter = self_counter;
+    SpaceSaving heavy = self_heavy;
+    HyperLogLog distinct = self_distinct;
+    if (!counter.merge(other.self_counter)
+    || !heavy.merge(other.self_heavy)
+    || !distinct.merge(other.self_distinct))
+      return false;
+    self_entries += other.self_entries;
+    self_counter = counter;
+    self_heavy = heavy;
+    self_distinct = distinct;
+    return true;
+  }
+
+
+  void
+  clear()
+  {
+    self_entries = 0;
+    self_counter.clear();
+    self_heavy.clear();
+    self_distinct.clear();
+  }
+
+
+  /**
+   * @brief Append serialized aggregator to the byte stream.
+   */
+  void
+  serialize(std::vector<byte>& stream) const
+  {
+    Sketch::put32(stream, 0x41474757); // "WGGA"
+    Sketch::put64(stream, self_seed);
+    Sketch::put64(stream, self_entries);
+    self_counter.serialize(stream);
+    self_heavy.serialize(stream);
+    self_distinct.serialize(stream);
+  }
+
+
+  /**
+   * @brief Read serialized aggregator from the byte stream.
+   *
+   * @return false if the stream is truncated or malformed
+   */
+  bool
+  deserialize(const byte* buffer,
+              const size_t& size)
+  {
+    if (buffer == NULL)
+      return false;
+    uint32_t magic;
+    uint64_t seed;
+    uint64_t entries;
+    const byte* tail = (buffer + size);
+    if (!Sketch::get32(buffer, tail, magic)
+    || !Sketch::get64(buffer, tail, seed)
+    || !Sketch::get64(buffer, tail, entries))
+      return false;
+    if (magic != 0x41474757)
+      return false;
+    CountMin counter;
+    SpaceSaving heavy;
+    HyperLogLog distinct;
+    if (!counter.deserialize(buffer, tail)
+    || !heavy.deserialize(buffer, tail)
+    || !distinct.deserialize(buffer, tail))
+      return false;
+    if ((counter.seed() != seed)
+    || (heavy.seed() != seed)
+    || (distinct.seed() != seed))
+      return false;
+    self_seed = seed;
+    self_entries = entries;
+    self_counter = counter;
+    self_heavy = heavy;
+    self_distinct = distinct;
+    return true;
+  }
+};
+
+
+} // namespace winmenu
+#endif // WINAPPUSAGE_AGGREGATOR_HPP
@@ -0,0 +1,156 @@
+/**
+ * @author    Dmitry Selyutin
+ * @copyright GNU General Public License v3.0+
+ */
+
+#ifndef WINAPPUSAGE_ENCODER_HPP
+#define WINAPPUSAGE_ENCODER_HPP
+#include "config.hpp"
+#include "stdint.hpp"
+#include "Usage.hpp"
+namespace winmenu {
+
+
+/**
+ * @brief Batched encoder of UserAssist entries.
+ *
+ * All records are kept in a single byte arena: every entry occupies
+ * the XP record immediately followed by the Windows 7 record, so both
+ * layouts are available without re-encoding. ROT13-encoded names are
+ * kept in a separate wide character arena, each name null-terminated.
+ */
+class Encoder
+{
+private: // PRIVATE MEMBERS
+  std::vector<byte> self_data;
+  std::vector<wchar_t> self_name;
+  std::vector<size_t> self_offset;
+
+
+public: // STATIC CONSTANTS
+  static const size_t XP_SIZE = 16;
+  static const size_t WIN7_SIZE = 72;
+  static const size_t STRIDE = (XP_SIZE + WIN7_SIZE);
+
+
+public: // CLASS FUNCTIONS
+  Encoder()
+  {
+  }
+
+
+  /**
+   * @brief Reserve memory for the given number of entries.
+   *
+   * @param count number of entries
+   * @param length expected average name length
+   */
+  void
+  reserve(const size_t& count,
+          const size_t& length = 64)
+  {
+    self_data.reserve(count * STRIDE);
+    self_name.reserve(count * (length + 1));
+    self_offset.reserve(count);
+  }
+
+
+  /**
+   * @brief Append the single entry.
+   *
+   * @param name plain (not encoded) file name
+   * @param counter number of times file was executed
+   * @param time last access time as FILETIME ticks
+   */
+  void
+  add(const wchar_t* name,
+      const uint32_t& counter,
+      const uint64_t& time)
+  {
+    const size_t offset = self_data.size();
+    self_data.resize(offset + STRIDE);
+    byte* record = &self_data[offset];
+    Usage::encode_data(counter, time, record, Usage::LAYOUT_XP);
+    Usage::encode_data(counter, time, record + XP_SIZE, Usage::LAYOUT_WIN7);
+    self_offset.push_back(self_name.size());
+    if (name)
+    {
+      for (; *name; ++name)
+        self_name.push_back(Usage::ROT13(*name));
+    }
+    self_name.push_back(0);
+  }
+
+
+  inline size_t
+  size() const
+  {
+    return self_offset.size();
+  }
+
+
+  /**
+   * @brief Retrieve ROT13-encoded name for the given index.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline const wchar_t*
+  name(const size_t& index) const
+  {
+    return &self_name[self_offset[index]];
+  }
+
+
+  /**
+   * @brief Retrieve length of the encoded name for the given index.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline size_t
+  namesize(const size_t& index) const
+  {
+    const size_t tail = ((index + 1) < self_offset.size())
+      ? self_offset[index + 1]
+      : self_name.size();
+    return (tail - self_offset[index] - 1);
+  }
+
+
+  /**
+   * @brief Retrieve record for the given index and layout.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline const byte*
+  buffer(const size_t& index,
+         const Usage::Layout& layout = Usage::LAYOUT_AUTO) const
+  {
+    const byte* record = &self_data[index * STRIDE];
+    if (Usage::record_size(layout) == WIN7_SIZE)
+      record += XP_SIZE;
+    return record;
+  }
+
+
+  /**
+   * @brief Retrieve record size for the given layout.
+   */
+  static inline size_t
+  buffersize(const Usage::Layout& layout = Usage::LAYOUT_AUTO)
+  {
+    return Usage::record_size(layout);
+  }
+
+
+  void
+  clear()
+  {
+    self_data.clear();
+    self_name.clear();
+    self_offset.clear();
+  }
+};
+
+
+} // namespace winmenu
+#endif // WINAPPUSAGE_ENCODER_HPP
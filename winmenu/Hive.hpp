@@ -0,0 +1,1274 @@
+/**
+ * @author    Dmitry Selyutin
+ * @copyright GNU General Public License v3.0+
+ */
+
+#ifndef WINAPPUSAGE_HIVE_HPP
+#define WINAPPUSAGE_HIVE_HPP
+#include "config.hpp"
+#include "stdint.hpp"
+#include "Status.hpp"
+#include "Usage.hpp"
+#include "MappedFile.hpp"
+#include "Sketch.hpp"
+namespace winmenu {
+
+
+/**
+ * @brief Reader of UserAssist entries from the offline regf hive.
+ *
+ * The base hive is memory-mapped and never copied. Dirty pages from the
+ * NTUSER.DAT.LOG1 and NTUSER.DAT.LOG2 transaction logs are replayed into
+ * the overlay: only hive bins touched by the logs are copied to memory
+ * and patched, all other cells are read directly from the mapping. Both
+ * the old format (dirty sector bitmap) and the new format (log entries,
+ * Windows 8.1 and newer) are supported.
+ *
+ * On refresh only new log entries are applied, and only UserAssist cells
+ * which lie in the freshly patched pages are parsed again.
+ *
+ * Offsets of the key cells may be cached in the sidecar index file, so
+ * that reopening the same hive skips the walk from the root key.
+ */
+class Hive
+{
+public: // PUBLIC TYPES
+  /**
+   * @brief UserAssist Count key.
+   */
+  struct Key
+  {
+    uint32_t cell;
+    uint32_t list;
+    uint32_t count;
+    size_t first;
+  };
+
+  /**
+   * @brief Decoded UserAssist value.
+   */
+  struct Value
+  {
+    uint32_t cell;
+    uint32_t data;
+    std::wstring name;
+    std::vector<byte> buffer;
+  };
+
+
+private: // PRIVATE TYPES
+  struct Region
+  {
+    uint32_t offset;
+    std::vector<byte> data;
+  };
+
+  struct Range
+  {
+    uint32_t offset;
+    uint32_t size;
+
+    inline bool
+    operator<(const Range& other) const
+    {
+      return (offset < other.offset);
+    }
+  };
+
+
+private: // PRIVATE MEMBERS
+  std::wstring self_path;
+  MappedFile self_base;
+  uint32_t self_sequence;
+  uint32_t self_root;
+  uint32_t self_length;
+  uint32_t self_baselength;
+  uint64_t self_timestamp;
+  uint32_t self_applied;
+  uint32_t self_legacy;
+  std::vector<Region*> self_overlay;
+  std::vector<Range> self_dirty;
+  std::vector<uint32_t> self_trail;
+  std::vector<Key> self_key;
+  std::vector<Value> self_value;
+
+
+public: // STATIC CONSTANTS
+  static const uint32_t BLOCK = 4096;
+  static const uint32_t SECTOR = 512;
+  static const uint32_t NONE = 0xFFFFFFFF;
+  static const uint32_t INDEX_VERSION = 1;
+
+
+public: // STATIC FUNCTIONS
+  static inline uint16_t
+  read16(const byte* buffer)
+  {
+    return static_cast<uint16_t>(buffer[0] | (buffer[1] << 8));
+  }
+
+
+  static inline uint32_t
+  read32(const byte* buffer)
+  {
+    return (static_cast<uint32_t>(buffer[0])
+      | (static_cast<uint32_t>(buffer[1]) << 8)
+      | (static_cast<uint32_t>(buffer[2]) << 16)
+      | (static_cast<uint32_t>(buffer[3]) << 24));
+  }
+
+
+  static inline uint64_t
+  read64(const byte* buffer)
+  {
+    return (static_cast<uint64_t>(Hive::read32(buffer))
+      | (static_cast<uint64_t>(Hive::read32(buffer + 4)) << 32));
+  }
+
+
+  /**
+   * @brief Check the XOR checksum of the base block.
+   */
+  static bool
+  checksum(const byte* block)
+  {
+    uint32_t code = 0;
+    for (size_t i = 0; i < 508; i += 4)
+      code ^= Hive::read32(block + i);
+    if (code == 0xFFFFFFFF)
+      code = 0xFFFFFFFE;
+    else if (code == 0)
+      code = 1;
+    return (code == Hive::read32(block + 508));
+  }
+
+
+  /**
+   * @brief Calculate Marvin32 hash used by the new log format.
+   */
+  static uint64_t
+  marvin32(const byte* buffer,
+           size_t size)
+  {
+#if (UINT64_MAX == ULONG_MAX)
+    const uint64_t seed = 0x82EF4D887A4E55C5UL;
+#else
+    const uint64_t seed = 0x82EF4D887A4E55C5ULL;
+#endif
+    uint32_t lpart = static_cast<uint32_t>(seed);
+    uint32_t hpart = static_cast<uint32_t>(seed >> 32);
+    for (; size >= 4; size -= 4, buffer += 4)
+    {
+      lpart += Hive::read32(buffer);
+      Hive::mix(lpart, hpart);
+    }
+    switch (size)
+    {
+      case 0:
+        lpart += 0x80;
+        break;
+      case 1:
+        lpart += (0x8000 | buffer[0]);
+        break;
+      case 2:
+        lpart += (0x800000 | Hive::read16(buffer));
+        break;
+      default:
+        lpart += (0x80000000 | (static_cast<uint32_t>(buffer[2]) << 16) | Hive::read16(buffer));
+        break;
+    }
+    Hive::mix(lpart, hpart);
+    Hive::mix(lpart, hpart);
+    return ((static_cast<uint64_t>(hpart) << 32) | lpart);
+  }
+
+
+private: // STATIC FUNCTIONS
+  static inline uint32_t
+  rotate(const uint32_t& code,
+         const unsigned& shift)
+  {
+    return ((code << shift) | (code >> (32 - shift)));
+  }
+
+
+  static inline void
+  mix(uint32_t& lpart,
+      uint32_t& hpart)
+  {
+    hpart ^= lpart;
+    lpart = Hive::rotate(lpart, 20);
+    lpart += hpart;
+    hpart = Hive::rotate(hpart, 9);
+    hpart ^= lpart;
+    lpart = Hive::rotate(lpart, 27);
+    lpart += hpart;
+    hpart = Hive::rotate(hpart, 19);
+  }
+
+
+  /**
+   * @brief Compare key name with ASCII string ignoring case.
+   */
+  static bool
+  match(const byte* name,
+        const size_t& size,
+        const bool& ascii,
+        const char* str)
+  {
+    const size_t length = ::strlen(str);
+    if (size != (ascii ? length : (2 * length)))
+      return false;
+    for (size_t i = 0; i < length; ++i)
+    {
+      uint32_t code = (ascii ? name[i] : Hive::read16(name + 2 * i));
+      uint32_t chr = static_cast<byte>(str[i]);
+      if ((code >= 'a') && (code <= 'z'))
+        code -= ('a' - 'A');
+      if ((chr >= 'a') && (chr <= 'z'))
+        chr -= ('a' - 'A');
+      if (code != chr)
+        return false;
+    }
+    return true;
+  }
+
+
+  /**
+   * @brief Calculate subkey name hash stored in lh lists.
+   */
+  static uint32_t
+  lhash(const char* str)
+  {
+    uint32_t code = 0;
+    for (; *str; ++str)
+    {
+      uint32_t chr = static_cast<byte>(*str);
+      if ((chr >= 'a') && (chr <= 'z'))
+        chr -= ('a' - 'A');
+      code = (code * 37 + chr);
+    }
+    return code;
+  }
+
+
+private: // PRIVATE FUNCTIONS
+  /**
+   * @brief Retrieve overlay region which contains the given offset.
+   */
+  Region*
+  overlay(const uint32_t& offset)
+  {
+    std::vector<Region*>::iterator iter = self_overlay.begin();
+    size_t count = self_overlay.size();
+    while (count > 0)
+    {
+      const size_t step = (count / 2);
+      std::vector<Region*>::iterator middle = (iter + step);
+      if ((*middle)->offset <= offset)
+      {
+        iter = ++middle;
+        count -= (step + 1);
+      }
+      else
+        count = step;
+    }
+    if (iter == self_overlay.begin())
+      return NULL;
+    Region* region = *--iter;
+    if ((offset - region->offset) >= region->data.size())
+      return NULL;
+    return region;
+  }
+
+
+  const Region*
+  overlay(const uint32_t& offset) const
+  {
+    return const_cast<Hive*>(this)->overlay(offset);
+  }
+
+
+  /**
+   * @brief Create overlay region for the page at the given offset.
+   *
+   * Regions cover whole hive bins, since cells never cross them; data
+   * beyond the end of the base hive goes to the single tail region.
+   * Regions are allocated separately, so that insertion moves pointers
+   * instead of copying the data of later regions.
+   */
+  Region&
+  reserve(const uint32_t& offset,
+          const uint32_t& tail)
+  {
+    Region region;
+    if (offset >= self_baselength)
+    {
+      Region* last = (self_overlay.empty() ? NULL : self_overlay.back());
+      if (last && (last->offset == self_baselength))
+      {
+        last->data.resize(std::max<size_t>(last->data.size(), tail - self_baselength), 0);
+        return *last;
+      }
+      region.offset = self_baselength;
+      region.data.resize(std::max(self_length, tail) - self_baselength, 0);
+    }
+    else
+    {
+      // Look for the hive bin header.
+      const byte* base = (self_base.data() + BLOCK);
+      uint32_t page = (offset & ~(BLOCK - 1));
+      uint32_t size = BLOCK;
+      for (uint32_t iter = page + BLOCK; iter > 0;)
+      {
+        iter -= BLOCK;
+        const byte* bin = (base + iter);
+        if ((::memcmp(bin, "hbin", 4) == 0) && (Hive::read32(bin + 4) == iter))
+        {
+          const uint32_t binsize = Hive::read32(bin + 8);
+          if ((binsize >= BLOCK) && ((iter + binsize) > offset))
+          {
+            page = iter;
+            size = binsize;
+          }
+          break;
+        }
+      }
+      size = std::min(size, self_baselength - page);
+      region.offset = page;
+      region.data.assign(base + page, base + page + size);
+    }
+    std::vector<Region*>::iterator iter = self_overlay.begin();
+    while ((iter != self_overlay.end()) && ((*iter)->offset < region.offset))
+      ++iter;
+    Region* result = new Region;
+    result->offset = region.offset;
+    result->data.swap(region.data);
+    self_overlay.insert(iter, result);
+    return *result;
+  }
+
+
+  /**
+   * @brief Write dirty data at the given hive bins offset.
+   */
+  void
+  apply(uint32_t offset,
+        const byte* data,
+        uint32_t size)
+  {
+    Range range;
+    range.offset = offset;
+    range.size = size;
+    self_dirty.push_back(range);
+    while (size > 0)
+    {
+      Region* region = this->overlay(offset);
+      if (region == NULL)
+        region = &this->reserve(offset, offset + size);
+      const uint32_t skip = (offset - region->offset);
+      uint32_t count = static_cast<uint32_t>(region->data.size() - skip);
+      count = std::min(count, size);
+      ::memcpy(&region->data[skip], data, count);
+      offset += count;
+      data += count;
+      size -= count;
+    }
+  }
+
+
+  /**
+   * @brief Collect valid new format log entries not older than sequence.
+   */
+  static void
+  collect(const MappedFile& log,
+          const uint32_t& sequence,
+          std::map<uint32_t, const byte*>& entries)
+  {
+    const byte* data = log.data();
+    const size_t size = log.size();
+    for (size_t offset = SECTOR; (offset + 40) <= size;)
+    {
+      const byte* entry = (data + offset);
+      if (::memcmp(entry, "HvLE", 4) != 0)
+        break;
+      const uint32_t entrysize = Hive::read32(entry + 4);
+      if ((entrysize < 40) || (entrysize % SECTOR) || (entrysize > (size - offset)))
+        break;
+      if (Hive::marvin32(entry, 32) != Hive::read64(entry + 32))
+        break;
+      if (Hive::marvin32(entry + 40, entrysize - 40) != Hive::read64(entry + 24))
+        break;
+      const uint32_t number = Hive::read32(entry + 12);
+      if ((number - sequence) < 0x80000000)
+        entries[number] = entry;
+      offset += entrysize;
+    }
+  }
+
+
+  /**
+   * @brief Apply single new format log entry.
+   */
+  bool
+  replay_entry(const byte* entry)
+  {
+    const uint32_t entrysize = Hive::read32(entry + 4);
+    const uint32_t length = Hive::read32(entry + 16);
+    const uint32_t pages = Hive::read32(entry + 20);
+    if ((pages > ((entrysize - 40) / 8)) || (length % BLOCK))
+      return false;
+    const byte* refs = (entry + 40);
+    const byte* data = (refs + 8 * pages);
+    const byte* tail = (entry + entrysize);
+    const byte* iter = data;
+    uint32_t end = self_length;
+    for (uint32_t i = 0; i < pages; ++i)
+    {
+      const uint32_t offset = Hive::read32(refs + 8 * i);
+      const uint32_t size = Hive::read32(refs + 8 * i + 4);
+      if ((size > static_cast<size_t>(tail - iter)) || (size > length) || (offset > (length - size)))
+        return false;
+      iter += size;
+      end = std::max(end, offset + size);
+    }
+
+    // Growth of the hive must be carried by the entry itself.
+    if ((end - self_length) > static_cast<size_t>(iter - data))
+      return false;
+    self_length = end;
+    for (uint32_t i = 0; i < pages; ++i)
+    {
+      const uint32_t offset = Hive::read32(refs + 8 * i);
+      const uint32_t size = Hive::read32(refs + 8 * i + 4);
+      this->apply(offset, data, size);
+      data += size;
+    }
+    return true;
+  }
+
+
+  /**
+   * @brief Apply old format log with dirty sector bitmap.
+   */
+  void
+  replay_legacy(const MappedFile& log)
+  {
+    const byte* data = log.data();
+    const size_t size = log.size();
+    const uint32_t length = Hive::read32(data + 40);
+    const size_t bits = (length / SECTOR);
+    const size_t head = (SECTOR + 4);
+    if ((length % SECTOR) || (size < (head + (bits + 7) / 8)))
+      return;
+    const byte* bitmap = (data + head);
+    size_t offset = (((head + (bits + 7) / 8) + SECTOR - 1) & ~static_cast<size_t>(SECTOR - 1));
+
+    // Growth of the hive must be carried by the log itself.
+    uint32_t end = self_length;
+    size_t carried = 0;
+    for (size_t i = 0; (i < bits) && ((offset + carried + SECTOR) <= size); ++i)
+    {
+      if (!(bitmap[i / 8] & (1 << (i % 8))))
+        continue;
+      carried += SECTOR;
+      end = std::max(end, static_cast<uint32_t>((i + 1) * SECTOR));
+    }
+    if ((end - self_length) > carried)
+      return;
+    self_length = end;
+    for (size_t i = 0; i < bits; ++i)
+    {
+      if (!(bitmap[i / 8] & (1 << (i % 8))))
+        continue;
+      if ((offset + SECTOR) > size)
+        return;
+      this->apply(static_cast<uint32_t>(i * SECTOR), data + offset, SECTOR);
+      offset += SECTOR;
+    }
+  }
+
+
+  /**
+   * @brief Apply transaction logs which have not been applied yet.
+   */
+  void
+  replay()
+  {
+    const wchar_t* suffix[2] = { L".LOG1", L".LOG2" };
+    MappedFile logs[2];
+    std::map<uint32_t, const byte*> entries;
+    const MappedFile* legacy = NULL;
+    uint32_t legacyseq = 0;
+    const bool dirty = (Hive::read32(self_base.data() + 4) != self_sequence);
+    for (size_t i = 0; i < 2; ++i)
+    {
+      MappedFile& log = logs[i];
+      if (!log.open((self_path + suffix[i]).c_str()).ok())
+        continue;
+      const byte* data = log.data();
+      if ((log.size() < (SECTOR + 4))
+      || (::memcmp(data, "regf", 4) != 0)
+      || !Hive::checksum(data))
+        continue;
+      if (Hive::read32(data + 28) == 6)
+      {
+        Hive::collect(log, self_applied, entries);
+        continue;
+      }
+
+      // Old format log is valid only if it has been completely written.
+      const uint32_t primary = Hive::read32(data + 4);
+      const uint32_t secondary = Hive::read32(data + 8);
+      if (!dirty
+      || (primary != secondary)
+      || (::memcmp(data + SECTOR, "DIRT", 4) != 0)
+      || ((secondary - self_sequence) >= 0x80000000))
+        continue;
+      if ((legacy == NULL) || ((secondary - legacyseq) < 0x80000000))
+      {
+        legacy = &log;
+        legacyseq = secondary;
+      }
+    }
+    if (legacy && (legacyseq != self_legacy))
+    {
+      this->replay_legacy(*legacy);
+      self_legacy = legacyseq;
+    }
+    std::map<uint32_t, const byte*>::const_iterator iter;
+    for (iter = entries.find(self_applied); iter != entries.end(); iter = entries.find(self_applied))
+    {
+      if (!this->replay_entry(iter->second))
+        break;
+      ++self_applied;
+    }
+
+    // Merge dirty ranges for the fast lookup.
+    std::sort(self_dirty.begin(), self_dirty.end());
+    std::vector<Range> merged;
+    for (size_t i = 0; i < self_dirty.size(); ++i)
+    {
+      const Range& range = self_dirty[i];
+      if (!merged.empty() && (range.offset <= (merged.back().offset + merged.back().size)))
+      {
+        Range& last = merged.back();
+        const uint32_t tail = std::max(last.offset + last.size, range.offset + range.size);
+        last.size = (tail - last.offset);
+      }
+      else
+        merged.push_back(range);
+    }
+    self_dirty.swap(merged);
+  }
+
+
+  /**
+   * @brief Check whether the cell was patched by the last replay.
+   */
+  bool
+  touched(const uint32_t& offset) const
+  {
+    if (self_dirty.empty() || (offset == NONE))
+      return false;
+    uint32_t size = 0;
+    if (this->cell(offset, size) == NULL)
+      return true;
+    Range key;
+    key.offset = (offset + size + 4);
+    key.size = 0;
+    std::vector<Range>::const_iterator iter;
+    iter = std::lower_bound(self_dirty.begin(), self_dirty.end(), key);
+    if (iter == self_dirty.begin())
+      return false;
+    --iter;
+    return ((iter->offset + iter->size) > offset);
+  }
+
+
+  /**
+   * @brief Retrieve subkeys listed in the given subkey list cell.
+   *
+   * @param name if not NULL, lh entries with mismatching hash are skipped
+   */
+  void
+  subkeys(const uint32_t& list,
+          const char* name,
+          std::vector<uint32_t>& result,
+          const size_t& depth = 0)
+  {
+    uint32_t size;
+    const byte* data = this->cell(list, size);
+    if ((data == NULL) || (size < 4) || (depth > 2))
+      return;
+    self_trail.push_back(list);
+    const uint32_t count = Hive::read16(data + 2);
+    const uint32_t hash = (name ? Hive::lhash(name) : 0);
+    if ((data[0] == 'l') && ((data[1] == 'f') || (data[1] == 'h')))
+    {
+      if (size < (4 + 8 * count))
+        return;
+      for (uint32_t i = 0; i < count; ++i)
+      {
+        const byte* item = (data + 4 + 8 * i);
+        if (name && (data[1] == 'h') && (Hive::read32(item + 4) != hash))
+          continue;
+        result.push_back(Hive::read32(item));
+      }
+    }
+    else if ((data[0] == 'l') && (data[1] == 'i'))
+    {
+      if (size < (4 + 4 * count))
+        return;
+      for (uint32_t i = 0; i < count; ++i)
+        result.push_back(Hive::read32(data + 4 + 4 * i));
+    }
+    else if ((data[0] == 'r') && (data[1] == 'i'))
+    {
+      if (size < (4 + 4 * count))
+        return;
+      for (uint32_t i = 0; i < count; ++i)
+        this->subkeys(Hive::read32(data + 4 + 4 * i), name, result, depth + 1);
+    }
+  }
+
+
+  /**
+   * @brief Find subkey with the given name.
+   *
+   * @return cell offset or NONE
+   */
+  uint32_t
+  subkey(const uint32_t& key,
+         const char* name)
+  {
+    uint32_t size;
+    const byte* data = this->cell(key, size);
+    if ((data == NULL) || (size < 76) || (data[0] != 'n') || (data[1] != 'k'))
+      return NONE;
+    std::vector<uint32_t> items;
+    if (Hive::read32(data + 20) != 0)
+      this->subkeys(Hive::read32(data + 28), name, items);
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+      uint32_t itemsize;
+      const byte* item = this->cell(items[i], itemsize);
+      if ((item == NULL) || (itemsize < 76) || (item[0] != 'n') || (item[1] != 'k'))
+        continue;
+      const size_t length = Hive::read16(item + 72);
+      const bool ascii = ((Hive::read16(item + 2) & 0x20) != 0);
+      if ((76 + length) > itemsize)
+        continue;
+      if (Hive::match(item + 76, length, ascii, name))
+        return items[i];
+    }
+    return NONE;
+  }
+
+
+  /**
+   * @brief Locate UserAssist Count keys starting from the root cell.
+   */
+  Status
+  walk()
+  {
+    self_trail.clear();
+    self_key.clear();
+    const char* path[] = {
+      "Software",
+      "Microsoft",
+      "Windows",
+      "CurrentVersion",
+      "Explorer",
+      "UserAssist"
+    };
+    uint32_t key = self_root;
+    self_trail.push_back(key);
+    for (size_t i = 0; i < (sizeof(path) / sizeof(path[0])); ++i)
+    {
+      key = this->subkey(key, path[i]);
+      if (key == NONE)
+        return Status(ERROR_FILE_NOT_FOUND, Status::STAGE_OPEN, i);
+      self_trail.push_back(key);
+    }
+
+    // Enumerate GUID subkeys.
+    uint32_t size;
+    const byte* data = this->cell(key, size);
+    std::vector<uint32_t> guids;
+    if (Hive::read32(data + 20) != 0)
+      this->subkeys(Hive::read32(data + 28), NULL, guids);
+    for (size_t i = 0; i < guids.size(); ++i)
+    {
+      self_trail.push_back(guids[i]);
+      const uint32_t count = this->subkey(guids[i], "Count");
+      if (count == NONE)
+        continue;
+      const byte* countdata = this->cell(count, size);
+      Key entry;
+      entry.cell = count;
+      entry.count = Hive::read32(countdata + 36);
+      entry.list = ((entry.count != 0) ? Hive::read32(countdata + 40) : NONE);
+      entry.first = 0;
+      self_key.push_back(entry);
+    }
+    return Status();
+  }
+
+
+  /**
+   * @brief Restore key cells from the sidecar index.
+   *
+   * The index is accepted only if it was written for the same base block
+   * (sequence numbers, time stamp, root cell and length) and the same set
+   * of replayed log entries; each cached key must still be an nk cell.
+   */
+  bool
+  load_index(const wchar_t* path)
+  {
+    MappedFile file;
+    if (!file.open(path).ok())
+      return false;
+    const byte* data = file.data();
+    const size_t size = file.size();
+    if ((size < 52) || (::memcmp(data, "WMHI", 4) != 0))
+      return false;
+    const byte* base = self_base.data();
+    const size_t trailsize = Hive::read32(data + 40);
+    const size_t keysize = Hive::read32(data + 44);
+    if ((Hive::read32(data + 4) != INDEX_VERSION)
+    || (Hive::read32(data + 8) != Hive::read32(base + 4))
+    || (Hive::read32(data + 12) != self_sequence)
+    || (Hive::read64(data + 16) != self_timestamp)
+    || (Hive::read32(data + 24) != self_root)
+    || (Hive::read32(data + 28) != self_baselength)
+    || (Hive::read32(data + 32) != self_applied)
+    || (Hive::read32(data + 36) != self_legacy)
+    || (trailsize > (size / 4))
+    || (keysize > (size / 12))
+    || (size != (48 + (4 * trailsize) + (12 * keysize) + 4))
+    || (Hive::read32(data + size - 4) != static_cast<uint32_t>(Hive::marvin32(data, size - 4))))
+      return false;
+
+    // Seek directly to cached cells.
+    const byte* iter = (data + 48);
+    std::vector<uint32_t> trail(trailsize);
+    for (size_t i = 0; i < trailsize; ++i, iter += 4)
+      trail[i] = Hive::read32(iter);
+    std::vector<Key> keys(keysize);
+    for (size_t i = 0; i < keysize; ++i, iter += 12)
+    {
+      uint32_t cellsize;
+      Key& key = keys[i];
+      key.cell = Hive::read32(iter);
+      key.list = Hive::read32(iter + 4);
+      key.count = Hive::read32(iter + 8);
+      key.first = 0;
+      const byte* cell = this->cell(key.cell, cellsize);
+      if ((cell == NULL) || (cellsize < 76) || (cell[0] != 'n') || (cell[1] != 'k'))
+        return false;
+    }
+    self_trail.swap(trail);
+    self_key.swap(keys);
+    return true;
+  }
+
+
+  /**
+   * @brief Write key cells to the sidecar index.
+   */
+  Status
+  save_index(const wchar_t* path) const
+  {
+    std::vector<byte> stream;
+    stream.insert(stream.end(), "WMHI", "WMHI" + 4);
+    Sketch::put32(stream, static_cast<uint32_t>(INDEX_VERSION));
+    Sketch::put32(stream, Hive::read32(self_base.data() + 4));
+    Sketch::put32(stream, self_sequence);
+    Sketch::put64(stream, self_timestamp);
+    Sketch::put32(stream, self_root);
+    Sketch::put32(stream, self_baselength);
+    Sketch::put32(stream, self_applied);
+    Sketch::put32(stream, self_legacy);
+    Sketch::put32(stream, static_cast<uint32_t>(self_trail.size()));
+    Sketch::put32(stream, static_cast<uint32_t>(self_key.size()));
+    for (size_t i = 0; i < self_trail.size(); ++i)
+      Sketch::put32(stream, self_trail[i]);
+    for (size_t i = 0; i < self_key.size(); ++i)
+    {
+      Sketch::put32(stream, self_key[i].cell);
+      Sketch::put32(stream, self_key[i].list);
+      Sketch::put32(stream, self_key[i].count);
+    }
+    Sketch::put32(stream, static_cast<uint32_t>(Hive::marvin32(&stream[0], stream.size())));
+
+#if !defined(WINAPPUSAGE_POSIX)
+    HANDLE handle = ::CreateFileW(
+      path,                       // file name
+      GENERIC_WRITE,              // desired access
+      0,                          // share mode
+      NULL,                       // security attributes
+      CREATE_ALWAYS,              // creation disposition
+      FILE_ATTRIBUTE_NORMAL,      // flags and attributes
+      NULL);                      // template file
+    if (handle == INVALID_HANDLE_VALUE)
+      return Status(::GetLastError(), Status::STAGE_WRITE);
+    DWORD written = 0;
+    BOOL state = ::WriteFile(
+      handle,
+      &stream[0],
+      static_cast<DWORD>(stream.size()),
+      &written,
+      NULL);
+    const DWORD error = ::GetLastError();
+    ::CloseHandle(handle);
+    if (!state || (written != stream.size()))
+      return Status(state ? ERROR_WRITE_FAULT : error, Status::STAGE_WRITE);
+#else
+    // Resolve the path in the same way as MappedFile does on reading.
+    std::string narrow;
+    if (!MappedFile::narrow(path, narrow))
+      return Status(ERROR_INVALID_PARAMETER, Status::STAGE_WRITE);
+    const int handle = ::open(narrow.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (handle < 0)
+      return Status(ERROR_ACCESS_DENIED, Status::STAGE_WRITE);
+    for (size_t offset = 0; offset < stream.size();)
+    {
+      const ssize_t written = ::write(handle, &stream[offset], stream.size() - offset);
+      if (written <= 0)
+      {
+        ::close(handle);
+        return Status(ERROR_WRITE_FAULT, Status::STAGE_WRITE);
+      }
+      offset += static_cast<size_t>(written);
+    }
+    if (::close(handle) != 0)
+      return Status(ERROR_WRITE_FAULT, Status::STAGE_WRITE);
+#endif
+    return Status();
+  }
+
+
+  /**
+   * @brief Decode the single vk cell.
+   */
+  bool
+  value(const uint32_t& offset,
+        Value& result) const
+  {
+    uint32_t size;
+    const byte* data = this->cell(offset, size);
+    if ((data == NULL) || (size < 20) || (data[0] != 'v') || (data[1] != 'k'))
+      return false;
+    const size_t length = Hive::read16(data + 2);
+    const uint32_t datasize = Hive::read32(data + 4);
+    const uint32_t dataoffset = Hive::read32(data + 8);
+    const bool ascii = ((Hive::read16(data + 16) & 1) != 0);
+    if ((20 + length) > size)
+      return false;
+
+    // Decode value name.
+    const byte* name = (data + 20);
+    result.cell = offset;
+    result.name.clear();
+    if (ascii)
+    {
+      result.name.reserve(length);
+      for (size_t i = 0; i < length; ++i)
+        result.name.push_back(Usage::ROT13(static_cast<wchar_t>(name[i])));
+    }
+    else
+    {
+      result.name.reserve(length / 2);
+      for (size_t i = 0; (i + 1) < length; i += 2)
+        result.name.push_back(Usage::ROT13(static_cast<wchar_t>(Hive::read16(name + i))));
+    }
+
+    // Copy value data.
+    if (datasize & 0x80000000)
+    {
+      const uint32_t count = std::min<uint32_t>(datasize & 0x7FFFFFFF, 4);
+      result.data = NONE;
+      result.buffer.assign(data + 8, data + 8 + count);
+      return true;
+    }
+    uint32_t cellsize;
+    const byte* cell = this->cell(dataoffset, cellsize);
+    if ((cell == NULL) || (cellsize < datasize))
+      return false;
+    result.data = dataoffset;
+    result.buffer.assign(cell, cell + datasize);
+    return true;
+  }
+
+
+  /**
+   * @brief Parse values of Count keys; reuse values which are untouched.
+   */
+  Status
+  parse(const bool& full)
+  {
+    bool rewalk = self_trail.empty();
+    for (size_t i = 0; !full && !rewalk && (i < self_trail.size()); ++i)
+      rewalk = this->touched(self_trail[i]);
+    std::vector<Key> keys = self_key;
+    if (rewalk)
+    {
+      Status status = this->walk();
+      if (!status.ok())
+      {
+        self_value.clear();
+        return status;
+      }
+    }
+
+    // Map previous values by their cells.
+    std::map<uint32_t, size_t> cache;
+    if (!full)
+    {
+      for (size_t i = 0; i < self_value.size(); ++i)
+        cache[self_value[i].cell] = i;
+    }
+    std::vector<Value> values;
+    for (size_t i = 0; i < self_key.size(); ++i)
+    {
+      Key& key = self_key[i];
+      std::vector<uint32_t> cells;
+      size_t previous = keys.size();
+      for (size_t j = 0; !full && (j < keys.size()); ++j)
+      {
+        if (keys[j].cell == key.cell)
+          previous = j;
+      }
+      if (!rewalk && this->touched(key.cell))
+      {
+        uint32_t size;
+        const byte* data = this->cell(key.cell, size);
+        if ((data == NULL) || (size < 76))
+          return Status(ERROR_REGISTRY_CORRUPT, Status::STAGE_DECODE, i);
+        key.count = Hive::read32(data + 36);
+        key.list = ((key.count != 0) ? Hive::read32(data + 40) : NONE);
+        previous = keys.size();
+      }
+      if ((previous != keys.size())
+      && (keys[previous].list == key.list)
+      && (keys[previous].count == key.count)
+      && !this->touched(key.list))
+      {
+        const size_t head = keys[previous].first;
+        const size_t tail = (((previous + 1) < keys.size())
+          ? keys[previous + 1].first
+          : self_value.size());
+        for (size_t j = head; j < tail; ++j)
+          cells.push_back(self_value[j].cell);
+      }
+      else if (key.list != NONE)
+      {
+        uint32_t size;
+        const byte* list = this->cell(key.list, size);
+        if ((list == NULL) || (size < (4 * key.count)))
+          return Status(ERROR_REGISTRY_CORRUPT, Status::STAGE_DECODE, i);
+        for (uint32_t j = 0; j < key.count; ++j)
+          cells.push_back(Hive::read32(list + 4 * j));
+      }
+
+      key.first = values.size();
+      for (size_t j = 0; j < cells.size(); ++j)
+      {
+        std::map<uint32_t, size_t>::const_iterator iter = cache.find(cells[j]);
+        if ((iter != cache.end())
+        && !this->touched(cells[j])
+        && !this->touched(self_value[iter->second].data))
+        {
+          values.push_back(self_value[iter->second]);
+          continue;
+        }
+        Value value;
+        if (this->value(cells[j], value))
+          values.push_back(value);
+      }
+    }
+    self_value.swap(values);
+    return Status();
+  }
+
+
+public: // CLASS FUNCTIONS
+  Hive()
+  : self_sequence(0)
+  , self_root(NONE)
+  , self_length(0)
+  , self_baselength(0)
+  , self_timestamp(0)
+  , self_applied(0)
+  , self_legacy(0)
+  {
+  }
+
+
+  ~Hive()
+  {
+    this->close();
+  }
+
+
+  /**
+   * @brief Open the hive, replay its logs and parse UserAssist values.
+   *
+   * @param path path to the primary hive file, e.g. "NTUSER.DAT"
+   * @param index optional path to the sidecar index of key cells
+   *
+   * If the index matches the hive, Count keys are taken from it without
+   * walking the tree; otherwise the index is rewritten after the walk.
+   * The index is only a cache, so failure to write it is ignored.
+   */
+  Status
+  open(const wchar_t* path,
+       const wchar_t* index = NULL)
+  {
+    this->close();
+    self_path = path;
+    Status status = self_base.open(path);
+    if (!status.ok())
+      return status;
+    const byte* data = self_base.data();
+    const size_t size = self_base.size();
+    if ((size < (2 * BLOCK))
+    || (::memcmp(data, "regf", 4) != 0)
+    || !Hive::checksum(data))
+    {
+      this->close();
+      return Status(ERROR_BADDB, Status::STAGE_DECODE);
+    }
+    self_sequence = Hive::read32(data + 8);
+    self_timestamp = Hive::read64(data + 12);
+    self_root = Hive::read32(data + 36);
+    self_baselength = Hive::read32(data + 40);
+    self_baselength = std::min<uint32_t>(self_baselength, static_cast<uint32_t>(size - BLOCK));
+    self_baselength &= ~(BLOCK - 1);
+    self_length = self_baselength;
+    self_applied = self_sequence;
+    this->replay();
+    bool indexed = (index && this->load_index(index));
+    status = this->parse(true);
+    if (!status.ok() && indexed)
+    {
+      self_trail.clear();
+      self_key.clear();
+      indexed = false;
+      status = this->parse(true);
+    }
+    if (status.ok() && index && !indexed)
+      this->save_index(index);
+    return status;
+  }
+
+
+  /**
+   * @brief Apply new log entries and parse values in patched cells.
+   *
+   * The base hive itself is assumed to be unchanged; open it again if
+   * the primary file has been replaced.
+   */
+  Status
+  refresh()
+  {
+    if (!self_base.is_open())
+      return Status(ERROR_INVALID_HANDLE, Status::STAGE_OPEN);
+    self_dirty.clear();
+    this->replay();
+    if (self_dirty.empty())
+      return Status();
+    return this->parse(false);
+  }
+
+
+  void
+  close()
+  {
+    self_base.close();
+    self_path.clear();
+    self_sequence = 0;
+    self_root = NONE;
+    self_length = 0;
+    self_baselength = 0;
+    self_timestamp = 0;
+    self_applied = 0;
+    self_legacy = 0;
+    for (size_t i = 0; i < self_overlay.size(); ++i)
+      delete self_overlay[i];
+    self_overlay.clear();
+    self_dirty.clear();
+    self_trail.clear();
+    self_key.clear();
+    self_value.clear();
+  }
+
+
+  /**
+   * @brief Retrieve cell data for the given hive bins offset.
+   *
+   * @param offset cell offset relative to the first hive bin
+   * @param size receives size of cell data
+   * @return pointer to cell data or NULL if cell is invalid or free
+   */
+  const byte*
+  cell(const uint32_t& offset,
+       uint32_t& size) const
+  {
+    size = 0;
+    if ((offset == NONE) || (offset >= self_length))
+      return NULL;
+    const byte* data;
+    size_t available;
+    const Region* region = this->overlay(offset);
+    if (region)
+    {
+      data = &region->data[offset - region->offset];
+      available = (region->data.size() - (offset - region->offset));
+    }
+    else if (offset < self_baselength)
+    {
+      data = (self_base.data() + BLOCK + offset);
+      available = (self_baselength - offset);
+    }
+    else
+      return NULL;
+    if (available < 8)
+      return NULL;
+    const int32_t cellsize = static_cast<int32_t>(Hive::read32(data));
+    if ((cellsize >= 0) || (static_cast<size_t>(-static_cast<int64_t>(cellsize)) > available))
+      return NULL;
+    size = static_cast<uint32_t>(-static_cast<int64_t>(cellsize) - 4);
+    return (data + 4);
+  }
+
+
+  /**
+   * @brief Number of bytes copied from the base hive and logs.
+   */
+  size_t
+  overlay_size() const
+  {
+    size_t result = 0;
+    for (size_t i = 0; i < self_overlay.size(); ++i)
+      result += self_overlay[i]->data.size();
+    return result;
+  }
+
+
+  /**
+   * @brief Last written time stamp from the base block.
+   */
+  inline uint64_t
+  timestamp() const
+  {
+    return self_timestamp;
+  }
+
+
+  inline const std::vector<Key>&
+  keys() const
+  {
+    return self_key;
+  }
+
+
+  inline size_t
+  size() const
+  {
+    return self_value.size();
+  }
+
+
+  /**
+   * @brief Retrieve decoded name for the given index.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline const wchar_t*
+  name(const size_t& index) const
+  {
+    return self_value[index].name.c_str();
+  }
+
+
+  /**
+   * @brief Retrieve buffer for the given index.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline const byte*
+  buffer(const size_t& index) const
+  {
+    const std::vector<byte>& buffer = self_value[index].buffer;
+    return (buffer.empty() ? NULL : &buffer[0]);
+  }
+
+
+  inline size_t
+  buffersize(const size_t& index) const
+  {
+    return self_value[index].buffer.size();
+  }
+
+
+  /**
+   * @brief Retrieve counter for the given index.
+   *
+   * Layout is chosen by the record size, since offline hive may come
+   * from the different Windows version.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline int32_t
+  counter(const size_t& index) const
+  {
+    time_t time;
+    uint32_t counter;
+    const size_t size = this->buffersize(index);
+    Usage::import_data(this->buffer(index), size, counter, time, Usage::layout(size));
+    return counter;
+  }
+
+
+  /**
+   * @brief Retrieve time stamp for the given index.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline time_t
+  time(const size_t& index,
+       FILETIME& filetime) const
+  {
+    const uint64_t stamp = this->stamp(index);
+    filetime.dwLowDateTime = static_cast<DWORD>(stamp);
+    filetime.dwHighDateTime = static_cast<DWORD>(stamp >> 32);
+    return static_cast<time_t>(stamp);
+  }
+
+
+  /**
+   * @brief Retrieve time stamp for the given index as FILETIME ticks.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline uint64_t
+  stamp(const size_t& index) const
+  {
+    uint64_t stamp;
+    uint32_t counter;
+    const size_t size = this->buffersize(index);
+    Usage::import_data(this->buffer(index), size, counter, stamp, Usage::layout(size));
+    return stamp;
+  }
+
+
+private:
+  Hive(const Hive&);
+  Hive& operator=(const Hive&);
+};
+
+
+} // namespace winmenu
+#endif // WINAPPUSAGE_HIVE_HPP
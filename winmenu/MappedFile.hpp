@@ -0,0 +1,205 @@
+/**
+ * @author    Dmitry Selyutin
+ * @copyright GNU General Public License v3.0+
+ */
+
+#ifndef WINAPPUSAGE_MAPPEDFILE_HPP
+#define WINAPPUSAGE_MAPPEDFILE_HPP
+#include "config.hpp"
+#include "stdint.hpp"
+#include "Status.hpp"
+namespace winmenu {
+
+
+/**
+ * @brief Read-only memory mapping of the whole file.
+ *
+ * Uses file mapping on Windows and mmap on Winelib builds (__WINE__). Files are
+ * opened with full sharing, so that hives and logs which are currently
+ * in use by the system can still be read.
+ */
+class MappedFile
+{
+private: // PRIVATE MEMBERS
+  const byte* self_data;
+  size_t self_size;
+#if !defined(WINAPPUSAGE_POSIX)
+  HANDLE self_file;
+  HANDLE self_mapping;
+#else
+  int self_file;
+#endif
+
+
+public: // STATIC FUNCTIONS
+  /**
+   * @brief Convert wide path to the UTF-8 path for POSIX calls.
+   *
+   * Wine uses 16 bit wide characters, so C library conversions do not
+   * apply. Other files written next to mapped ones (e.g. Hive sidecar
+   * index) must use the same conversion, so that both resolve the path
+   * in the same way.
+   */
+  static bool
+  narrow(const wchar_t* path,
+         std::string& result)
+  {
+    const int length = ::WideCharToMultiByte(CP_UTF8, 0, path, -1, NULL, 0, NULL, NULL);
+    if (length <= 0)
+      return false;
+    result.assign(static_cast<size_t>(length), '\0');
+    ::WideCharToMultiByte(CP_UTF8, 0, path, -1, &result[0], length, NULL, NULL);
+    result.resize(static_cast<size_t>(length - 1));
+    return true;
+  }
+
+
+public: // CLASS FUNCTIONS
+  MappedFile()
+  : self_data(NULL)
+  , self_size(0)
+#if !defined(WINAPPUSAGE_POSIX)
+  , self_file(INVALID_HANDLE_VALUE)
+  , self_mapping(NULL)
+#else
+  , self_file(-1)
+#endif
+  {
+  }
+
+
+  ~MappedFile()
+  {
+    this->close();
+  }
+
+
+  /**
+   * @brief Map the given file; empty files are mapped as zero bytes.
+   */
+  Status
+  open(const wchar_t* path)
+  {
+    this->close();
+#if !defined(WINAPPUSAGE_POSIX)
+    self_file = ::CreateFileW(
+      path,                       // file name
+      GENERIC_READ,               // desired access
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+      NULL,                       // security attributes
+      OPEN_EXISTING,              // creation disposition
+      FILE_ATTRIBUTE_NORMAL,      // flags and attributes
+      NULL);                      // template file
+    if (self_file == INVALID_HANDLE_VALUE)
+      return Status(::GetLastError(), Status::STAGE_OPEN);
+    LARGE_INTEGER size;
+    if (!::GetFileSizeEx(self_file, &size))
+    {
+      const DWORD state = ::GetLastError();
+      this->close();
+      return Status(state, Status::STAGE_OPEN);
+    }
+    if (size.QuadPart == 0)
+      return Status();
+    self_mapping = ::CreateFileMappingW(self_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (self_mapping == NULL)
+    {
+      const DWORD state = ::GetLastError();
+      this->close();
+      return Status(state, Status::STAGE_OPEN);
+    }
+    self_data = static_cast<const byte*>(
+      ::MapViewOfFile(self_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (self_data == NULL)
+    {
+      const DWORD state = ::GetLastError();
+      this->close();
+      return Status(state, Status::STAGE_OPEN);
+    }
+    self_size = static_cast<size_t>(size.QuadPart);
+#else
+    std::string narrow;
+    if (!MappedFile::narrow(path, narrow))
+      return Status(ERROR_INVALID_PARAMETER, Status::STAGE_OPEN);
+    self_file = ::open(narrow.c_str(), O_RDONLY);
+    if (self_file < 0)
+      return Status(ERROR_FILE_NOT_FOUND, Status::STAGE_OPEN);
+    struct stat info;
+    if (::fstat(self_file, &info) != 0)
+    {
+      this->close();
+      return Status(ERROR_ACCESS_DENIED, Status::STAGE_OPEN);
+    }
+    if (info.st_size == 0)
+      return Status();
+    void* data = ::mmap(NULL, static_cast<size_t>(info.st_size),
+                        PROT_READ, MAP_SHARED, self_file, 0);
+    if (data == MAP_FAILED)
+    {
+      this->close();
+      return Status(ERROR_NOT_ENOUGH_MEMORY, Status::STAGE_OPEN);
+    }
+    self_data = static_cast<const byte*>(data);
+    self_size = static_cast<size_t>(info.st_size);
+#endif
+    return Status();
+  }
+
+
+  void
+  close()
+  {
+#if !defined(WINAPPUSAGE_POSIX)
+    if (self_data)
+      ::UnmapViewOfFile(self_data);
+    if (self_mapping)
+      ::CloseHandle(self_mapping);
+    if (self_file != INVALID_HANDLE_VALUE)
+      ::CloseHandle(self_file);
+    self_mapping = NULL;
+    self_file = INVALID_HANDLE_VALUE;
+#else
+    if (self_data)
+      ::munmap(const_cast<byte*>(self_data), self_size);
+    if (self_file >= 0)
+      ::close(self_file);
+    self_file = -1;
+#endif
+    self_data = NULL;
+    self_size = 0;
+  }
+
+
+  inline bool
+  is_open() const
+  {
+#if !defined(WINAPPUSAGE_POSIX)
+    return (self_file != INVALID_HANDLE_VALUE);
+#else
+    return (self_file >= 0);
+#endif
+  }
+
+
+  inline const byte*
+  data() const
+  {
+    return self_data;
+  }
+
+
+  inline size_t
+  size() const
+  {
+    return self_size;
+  }
+
+
+private:
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+};
+
+
+} // namespace winmenu
+#endif // WINAPPUSAGE_MAPPEDFILE_HPP
@@ -0,0 +1,280 @@
+/**
+ * @author    Dmitry Selyutin
+ * @copyright GNU General Public License v3.0+
+ */
+
+#ifndef WINAPPUSAGE_REGWRITER_HPP
+#define WINAPPUSAGE_REGWRITER_HPP
+#include "config.hpp"
+#include "stdint.hpp"
+#include "Status.hpp"
+#include "Usage.hpp"
+#include "Encoder.hpp"
+namespace winmenu {
+
+
+/**
+ * @brief Streaming writer of registry export (.reg) files.
+ *
+ * Output is UTF-16LE "Windows Registry Editor Version 5.00" format, which
+ * is accepted by both regedit and Wine. Text is collected in the fixed
+ * size buffer and written to disk only when the buffer is full, so that
+ * hundreds of thousands of values are written in a single pass.
+ */
+class RegWriter
+{
+private: // PRIVATE MEMBERS
+  HANDLE self_handle;
+  Status self_status;
+  std::vector<byte> self_buffer;
+  size_t self_used;
+
+
+private: // PRIVATE FUNCTIONS
+  inline void
+  put(const wchar_t& code)
+  {
+    if ((self_used + 2) > self_buffer.size())
+      this->flush();
+    self_buffer[self_used++] = static_cast<byte>(code);
+    self_buffer[self_used++] = static_cast<byte>(static_cast<uint16_t>(code) >> 8);
+  }
+
+
+  inline void
+  put(const wchar_t* str)
+  {
+    for (; *str; ++str)
+      this->put(*str);
+  }
+
+
+  inline void
+  put_escaped(const wchar_t* str,
+              const size_t& size)
+  {
+    for (size_t i = 0; i < size; ++i)
+    {
+      if ((str[i] == L'\\') || (str[i] == L'"'))
+        this->put(L'\\');
+      this->put(str[i]);
+    }
+  }
+
+
+  /**
+   * @brief Write bytes as hex list; six characters per byte at most.
+   */
+  void
+  put_hex(const byte* data,
+          const size_t& size)
+  {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < size; ++i)
+    {
+      if ((self_used + 6) > self_buffer.size())
+        this->flush();
+      byte* iter = &self_buffer[self_used];
+      if (i != 0)
+      {
+        *iter++ = ',';
+        *iter++ = 0;
+      }
+      *iter++ = digits[data[i] >> 4];
+      *iter++ = 0;
+      *iter++ = digits[data[i] & 0x0F];
+      *iter++ = 0;
+      self_used = static_cast<size_t>(iter - &self_buffer[0]);
+    }
+  }
+
+
+public: // CLASS FUNCTIONS
+  /**
+   * @param capacity size of the output buffer in bytes
+   */
+  RegWriter(const size_t& capacity = (1 << 20))
+  : self_handle(INVALID_HANDLE_VALUE)
+  , self_buffer(std::max<size_t>(capacity, 64))
+  , self_used(0)
+  {
+  }
+
+
+  ~RegWriter()
+  {
+    this->close();
+  }
+
+
+  /**
+   * @brief Create the file and write the .reg header.
+   */
+  Status
+  open(const wchar_t* path)
+  {
+    this->close();
+    self_status = Status();
+    self_handle = ::CreateFileW(
+      path,                       // file name
+      GENERIC_WRITE,              // desired access
+      0,                          // share mode
+      NULL,                       // security attributes
+      CREATE_ALWAYS,              // creation disposition
+      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+      NULL);                      // template file
+    if (self_handle == INVALID_HANDLE_VALUE)
+    {
+      self_status = Status(::GetLastError(), Status::STAGE_OPEN);
+      return self_status;
+    }
+    self_buffer[self_used++] = 0xFF; // byte order mark
+    self_buffer[self_used++] = 0xFE;
+    this->put(L"Windows Registry Editor Version 5.00\r\n");
+    return self_status;
+  }
+
+
+  /**
+   * @brief Start the new key section.
+   *
+   * @param key full key path, e.g. "HKEY_CURRENT_USER\\Software"
+   */
+  void
+  key(const wchar_t* key)
+  {
+    this->put(L"\r\n[");
+    this->put(key);
+    this->put(L"]\r\n");
+  }
+
+
+  /**
+   * @brief Write REG_BINARY value of the current key.
+   *
+   * @param name value name as stored in registry
+   * @param namesize length of the value name
+   * @param data value data
+   * @param size size of value data
+   */
+  void
+  value(const wchar_t* name,
+        const size_t& namesize,
+        const byte* data,
+        const size_t& size)
+  {
+    this->put(L'"');
+    this->put_escaped(name, namesize);
+    this->put(L"\"=hex:");
+    this->put_hex(data, size);
+    this->put(L"\r\n");
+  }
+
+
+  /**
+   * @brief Write all entries of the encoder into the single Count key.
+   *
+   * @param encoder batch of encoded entries
+   * @param layout binary layout of the records
+   * @param guid UserAssist GUID; default one for the layout if NULL
+   */
+  void
+  write(const Encoder& encoder,
+        Usage::Layout layout = Usage::LAYOUT_AUTO,
+        const wchar_t* guid = NULL)
+  {
+    if (layout == Usage::LAYOUT_AUTO)
+      layout = Usage::layout();
+    if (guid == NULL)
+    {
+      if (layout == Usage::LAYOUT_WIN7)
+        guid = L"{CEBFF5CD-ACE2-4F4F-9178-9926F41749EA}";
+      else
+        guid = L"{75048700-EF1F-11D0-9888-006097DEACF9}";
+    }
+    std::wstring key;
+    key += L"HKEY_CURRENT_USER\\Software\\Microsoft\\Windows\\CurrentVersion\\Explorer\\UserAssist\\";
+    key += guid;
+    key += L"\\Count";
+    this->key(key.c_str());
+    const size_t size = Encoder::buffersize(layout);
+    for (size_t i = 0; i < encoder.size(); ++i)
+    {
+      this->value(encoder.name(i),
+                  encoder.namesize(i),
+                  encoder.buffer(i, layout),
+                  size);
+    }
+  }
+
+
+  /**
+   * @brief Write buffered data to disk.
+   *
+   * Once writing fails, all further output is discarded and the failure
+   * is reported by flush, close and status.
+   */
+  Status
+  flush()
+  {
+    if ((self_handle != INVALID_HANDLE_VALUE) && self_status.ok())
+    {
+      size_t offset = 0;
+      while (offset < self_used)
+      {
+        DWORD written = 0;
+        BOOL state = ::WriteFile(
+          self_handle,
+          &self_buffer[offset],
+          static_cast<DWORD>(self_used - offset),
+          &written,
+          NULL);
+        if (!state)
+        {
+          self_status = Status(::GetLastError(), Status::STAGE_WRITE);
+          break;
+        }
+        if (written == 0)
+        {
+          self_status = Status(ERROR_WRITE_FAULT, Status::STAGE_WRITE);
+          break;
+        }
+        offset += written;
+      }
+    }
+    self_used = 0;
+    return self_status;
+  }
+
+
+  /**
+   * @brief Flush remaining data and close the file.
+   */
+  Status
+  close()
+  {
+    if (self_handle == INVALID_HANDLE_VALUE)
+      return self_status;
+    this->put(L"\r\n");
+    this->flush();
+    ::CloseHandle(self_handle);
+    self_handle = INVALID_HANDLE_VALUE;
+    return self_status;
+  }
+
+
+  inline const Status&
+  status() const
+  {
+    return self_status;
+  }
+
+
+private:
+  RegWriter(const RegWriter&);
+  RegWriter& operator=(const RegWriter&);
+};
+
+
+} // namespace winmenu
+#endif // WINAPPUSAGE_REGWRITER_HPP
@@ -0,0 +1,850 @@
+/**
+ * @author    Dmitry Selyutin
+ * @copyright GNU General Public License v3.0+
+ */
+
+#ifndef WINAPPUSAGE_SKETCH_HPP
+#define WINAPPUSAGE_SKETCH_HPP
+#include "config.hpp"
+#include "stdint.hpp"
+namespace winmenu {
+
+
+/**
+ * @brief Helpers shared by all sketches: hashing and byte serialization.
+ *
+ * Sketches are serialized in little-endian order, so that sketches built
+ * on different hosts can be merged regardless of their architecture.
+ */
+class Sketch
+{
+public: // STATIC FUNCTIONS
+  /**
+   * @brief Mix 64 bit integer (MurmurHash3 finalizer).
+   */
+  static inline uint64_t
+  mix(uint64_t code)
+  {
+#if (UINT64_MAX == ULONG_MAX)
+    code ^= (code >> 33);
+    code *= 0xFF51AFD7ED558CCDUL;
+    code ^= (code >> 33);
+    code *= 0xC4CEB9FE1A85EC53UL;
+    code ^= (code >> 33);
+#else
+    code ^= (code >> 33);
+    code *= 0xFF51AFD7ED558CCDULL;
+    code ^= (code >> 33);
+    code *= 0xC4CEB9FE1A85EC53ULL;
+    code ^= (code >> 33);
+#endif
+    return code;
+  }
+
+
+  /**
+   * @brief Calculate 64 bit hash of the file name.
+   *
+   * @param name null-terminated file name
+   * @param seed hash seed
+   *
+   * Windows file names are case-insensitive, so ASCII letters are folded
+   * to lower case before hashing.
+   */
+  static inline uint64_t
+  hash(const wchar_t* name,
+       const uint64_t& seed = 0)
+  {
+#if (UINT64_MAX == ULONG_MAX)
+    uint64_t code = (0xCBF29CE484222325UL ^ seed);
+    const uint64_t prime = 0x100000001B3UL;
+#else
+    uint64_t code = (0xCBF29CE484222325ULL ^ seed);
+    const uint64_t prime = 0x100000001B3ULL;
+#endif
+    if (name == NULL)
+      return Sketch::mix(code);
+    for (; *name; ++name)
+    {
+      wchar_t chr = *name;
+      if ((chr >= 'A') && (chr <= 'Z'))
+        chr += ('a' - 'A');
+      code ^= static_cast<uint64_t>(static_cast<uint32_t>(chr));
+      code *= prime;
+    }
+    return Sketch::mix(code);
+  }
+
+
+  /**
+   * @brief Append 32 bit integer to the byte stream.
+   */
+  static inline void
+  put32(std::vector<byte>& stream,
+        const uint32_t& code)
+  {
+    for (size_t i = 0; i < 4; ++i)
+      stream.push_back(static_cast<byte>(code >> (i * 8)));
+  }
+
+
+  /**
+   * @brief Append 64 bit integer to the byte stream.
+   */
+  static inline void
+  put64(std::vector<byte>& stream,
+        const uint64_t& code)
+  {
+    for (size_t i = 0; i < 8; ++i)
+      stream.push_back(static_cast<byte>(code >> (i * 8)));
+  }
+
+
+  /**
+   * @brief Read 32 bit integer from the byte stream.
+   *
+   * @return false if there is not enough data
+   */
+  static inline bool
+  get32(const byte*& buffer,
+        const byte* tail,
+        uint32_t& code)
+  {
+    code = 0;
+    if ((tail - buffer) < 4)
+      return false;
+    for (size_t i = 0; i < 4; ++i)
+      code |= (static_cast<uint32_t>(buffer[i]) << (i * 8));
+    buffer += 4;
+    return true;
+  }
+
+
+  /**
+   * @brief Read 64 bit integer from the byte stream.
+   *
+   * @return false if there is not enough data
+   */
+  static inline bool
+  get64(const byte*& buffer,
+        const byte* tail,
+        uint64_t& code)
+  {
+    code = 0;
+    if ((tail - buffer) < 8)
+      return false;
+    for (size_t i = 0; i < 8; ++i)
+      code |= (static_cast<uint64_t>(buffer[i]) << (i * 8));
+    buffer += 8;
+    return true;
+  }
+};
+
+
+/**
+ * @brief Count-min sketch for approximate launch counters.
+ *
+ * Estimates never underestimate the real counter; with width w and depth d
+ * the overestimate is at most (e / w) * total with probability 1 - e^(-d).
+ * Sketches are mergeable if they have the same dimensions and seed.
+ */
+class CountMin
+{
+private: // PRIVATE MEMBERS
+  size_t self_width;
+  size_t self_depth;
+  uint64_t self_seed;
+  uint64_t self_total;
+  std::vector<uint64_t> self_table;
+
+
+public: // CLASS FUNCTIONS
+  CountMin(const size_t& width = 2048,
+           const size_t& depth = 4,
+           const uint64_t& seed = 0)
+  : self_width((width == 0) ? 1 : width)
+  , self_depth((depth == 0) ? 1 : depth)
+  , self_seed(seed)
+  , self_total(0)
+  , self_table(self_width * self_depth, 0)
+  {
+  }
+
+
+  /**
+   * @brief Add weight to the counter of the given name.
+   */
+  void
+  add(const wchar_t* name,
+      const uint64_t& weight = 1)
+  {
+    this->add_hash(Sketch::hash(name, self_seed), weight);
+  }
+
+
+  /**
+   * @brief Add weight to the counter of the already hashed name.
+   */
+  void
+  add_hash(const uint64_t& code,
+           const uint64_t& weight = 1)
+  {
+    const uint64_t hpart = code;
+    const uint64_t lpart = (Sketch::mix(code) | 1);
+    for (size_t row = 0; row < self_depth; ++row)
+    {
+      const uint64_t column = ((hpart + row * lpart) % self_width);
+      self_table[row * self_width + column] += weight;
+    }
+    self_total += weight;
+  }
+
+
+  /**
+   * @brief Estimate counter of the given name.
+   */
+  uint64_t
+  estimate(const wchar_t* name) const
+  {
+    return this->estimate_hash(Sketch::hash(name, self_seed));
+  }
+
+
+  /**
+   * @brief Estimate counter of the already hashed name.
+   */
+  uint64_t
+  estimate_hash(const uint64_t& code) const
+  {
+    uint64_t result = UINT64_MAX;
+    const uint64_t hpart = code;
+    const uint64_t lpart = (Sketch::mix(code) | 1);
+    for (size_t row = 0; row < self_depth; ++row)
+    {
+      const uint64_t column = ((hpart + row * lpart) % self_width);
+      result = std::min(result, self_table[row * self_width + column]);
+    }
+    return result;
+  }
+
+
+  /**
+   * @brief Sum of all weights added to the sketch.
+   */
+  inline uint64_t
+  total() const
+  {
+    return self_total;
+  }
+
+
+  inline uint64_t
+  seed() const
+  {
+    return self_seed;
+  }
+
+
+  /**
+   * @brief Merge another sketch into this one.
+   *
+   * @return false if sketches have different dimensions or seeds
+   */
+  bool
+  merge(const CountMin& other)
+  {
+    if ((self_width != other.self_width)
+    || (self_depth != other.self_depth)
+    || (self_seed != other.self_seed))
+      return false;
+    for (size_t i = 0; i < self_table.size(); ++i)
+      self_table[i] += other.self_table[i];
+    self_total += other.self_total;
+    return true;
+  }
+
+
+  void
+  clear()
+  {
+    self_total = 0;
+    std::fill(self_table.begin(), self_table.end(), 0);
+  }
+
+
+  /**
+   * @brief Append serialized sketch to the byte stream.
+   */
+  void
+  serialize(std::vector<byte>& stream) const
+  {
+    Sketch::put32(stream, static_cast<uint32_t>(self_width));
+    Sketch::put32(stream, static_cast<uint32_t>(self_depth));
+    Sketch::put64(stream, self_seed);
+    Sketch::put64(stream, self_total);
+    for (size_t i = 0; i < self_table.size(); ++i)
+      Sketch::put64(stream, self_table[i]);
+  }
+
+
+  /**
+   * @brief Read serialized sketch from the byte stream.
+   *
+   * @return false if the stream is truncated or malformed
+   */
+  bool
+  deserialize(const byte*& buffer,
+              const byte* tail)
+  {
+    uint32_t width;
+    uint32_t depth;
+    uint64_t seed;
+    uint64_t total;
+    if (!Sketch::get32(buffer, tail, width)
+    || !Sketch::get32(buffer, tail, depth)
+    || !Sketch::get64(buffer, tail, seed)
+    || !Sketch::get64(buffer, tail, total))
+      return false;
+    if ((width == 0) || (depth == 0))
+      return false;
+    const uint64_t cells = (static_cast<uint64_t>(width) * depth);
+    if (cells > (static_cast<uint64_t>(tail - buffer) / 8))
+      return false;
+    std::vector<uint64_t> table(static_cast<size_t>(cells));
+    for (size_t i = 0; i < table.size(); ++i)
+      Sketch::get64(buffer, tail, table[i]);
+    self_width = width;
+    self_depth = depth;
+    self_seed = seed;
+    self_total = total;
+    self_table.swap(table);
+    return true;
+  }
+};
+
+
+/**
+ * @brief Space-Saving heavy hitters summary.
+ *
+ * Keeps at most capacity names; every reported counter overestimates the
+ * real one by no more than its error, which is bounded by total / capacity.
+ * Counters live in a binary min-heap, so that the smallest counter can be
+ * evicted in logarithmic time.
+ */
+class SpaceSaving
+{
+public: // PUBLIC TYPES
+  struct Entry
+  {
+    std::wstring name;
+    uint64_t hash;
+    uint64_t count;
+    uint64_t error;
+  };
+
+
+private: // PRIVATE MEMBERS
+  size_t self_capacity;
+  uint64_t self_seed;
+  std::vector<Entry> self_entry;
+  std::vector<size_t> self_heap;
+  std::vector<size_t> self_position;
+  std::map<uint64_t, size_t> self_index;
+
+
+private: // PRIVATE FUNCTIONS
+  inline bool
+  less(const size_t& lhs,
+       const size_t& rhs) const
+  {
+    return (self_entry[self_heap[lhs]].count < self_entry[self_heap[rhs]].count);
+  }
+
+
+  inline void
+  swap(const size_t& lhs,
+       const size_t& rhs)
+  {
+    std::swap(self_heap[lhs], self_heap[rhs]);
+    self_position[self_heap[lhs]] = lhs;
+    self_position[self_heap[rhs]] = rhs;
+  }
+
+
+  void
+  sift_up(size_t index)
+  {
+    while (index > 0)
+    {
+      const size_t parent = ((index - 1) / 2);
+      if (!this->less(index, parent))
+        break;
+      this->swap(index, parent);
+      index = parent;
+    }
+  }
+
+
+  void
+  sift_down(size_t index)
+  {
+    const size_t size = self_heap.size();
+    for (;;)
+    {
+      size_t least = index;
+      const size_t lchild = (2 * index + 1);
+      const size_t rchild = (2 * index + 2);
+      if ((lchild < size) && this->less(lchild, least))
+        least = lchild;
+      if ((rchild < size) && this->less(rchild, least))
+        least = rchild;
+      if (least == index)
+        break;
+      this->swap(index, least);
+      index = least;
+    }
+  }
+
+
+  static inline bool
+  greater(const Entry& lhs,
+          const Entry& rhs)
+  {
+    if (lhs.count != rhs.count)
+      return (lhs.count > rhs.count);
+    return (lhs.hash < rhs.hash);
+  }
+
+
+public: // CLASS FUNCTIONS
+  SpaceSaving(const size_t& capacity = 256,
+              const uint64_t& seed = 0)
+  : self_capacity((capacity == 0) ? 1 : capacity)
+  , self_seed(seed)
+  {
+  }
+
+
+  /**
+   * @brief Add weight to the counter of the given name.
+   */
+  void
+  add(const wchar_t* name,
+      const uint64_t& weight = 1)
+  {
+    this->add_hash(name, Sketch::hash(name, self_seed), weight, 0);
+  }
+
+
+  /**
+   * @brief Add weight and error to the counter of the already hashed name.
+   */
+  void
+  add_hash(const wchar_t* name,
+           const uint64_t& code,
+           const uint64_t& weight,
+           const uint64_t& error)
+  {
+    std::map<uint64_t, size_t>::iterator iter = self_index.find(code);
+    if (iter != self_index.end())
+    {
+      Entry& entry = self_entry[iter->second];
+      entry.count += weight;
+      entry.error += error;
+      this->sift_down(self_position[iter->second]);
+      return;
+    }
+    if (self_entry.size() < self_capacity)
+    {
+      Entry entry;
+      entry.name = (name ? name : L"");
+      entry.hash = code;
+      entry.count = weight;
+      entry.error = error;
+      const size_t slot = self_entry.size();
+      self_entry.push_back(entry);
+      self_heap.push_back(slot);
+      self_position.push_back(slot);
+      self_index[code] = slot;
+      this->sift_up(self_heap.size() - 1);
+      return;
+    }
+
+    // Evict the smallest counter and inherit its value as error.
+    const size_t slot = self_heap[0];
+    Entry& entry = self_entry[slot];
+    const uint64_t minimum = entry.count;
+    self_index.erase(entry.hash);
+    entry.name = (name ? name : L"");
+    entry.hash = code;
+    entry.count = (minimum + weight);
+    entry.error = (minimum + error);
+    self_index[code] = slot;
+    this->sift_down(0);
+  }
+
+
+  /**
+   * @brief Smallest tracked counter or 0 if the summary is not full.
+   */
+  inline uint64_t
+  minimum() const
+  {
+    if (self_entry.size() < self_capacity)
+      return 0;
+    return self_entry[self_heap[0]].count;
+  }
+
+
+  inline size_t
+  size() const
+  {
+    return self_entry.size();
+  }
+
+
+  inline size_t
+  capacity() const
+  {
+    return self_capacity;
+  }
+
+
+  inline uint64_t
+  seed() const
+  {
+    return self_seed;
+  }
+
+
+  /**
+   * @brief Retrieve up to count entries with the largest counters.
+   */
+  void
+  top(const size_t& count,
+      std::vector<Entry>& result) const
+  {
+    result = self_entry;
+    const size_t size = std::min(count, result.size());
+    std::partial_sort(result.begin(),
+                      result.begin() + size,
+                      result.end(),
+                      SpaceSaving::greater);
+    result.resize(size);
+  }
+
+
+  /**
+   * @brief Merge another summary into this one.
+   *
+   * Names missing in one of the summaries are assumed to have the minimum
+   * counter of that summary, which keeps the merged counters upper bounds.
+   *
+   * @return false if summaries have different seeds
+   */
+  bool
+  merge(const SpaceSaving& other)
+  {
+    if (self_seed != other.self_seed)
+      return false;
+    const uint64_t lminimum = this->minimum();
+    const uint64_t rminimum = other.minimum();
+    std::vector<Entry> entries;
+    entries.reserve(self_entry.size() + other.self_entry.size());
+    for (size_t i = 0; i < self_entry.size(); ++i)
+    {
+      Entry entry = self_entry[i];
+      std::map<uint64_t, size_t>::const_iterator iter;
+      iter = other.self_index.find(entry.hash);
+      if (iter == other.self_index.end())
+      {
+        entry.count += rminimum;
+        entry.error += rminimum;
+      }
+      else
+      {
+        entry.count += other.self_entry[iter->second].count;
+        entry.error += other.self_entry[iter->second].error;
+      }
+      entries.push_back(entry);
+    }
+    for (size_t i = 0; i < other.self_entry.size(); ++i)
+    {
+      Entry entry = other.self_entry[i];
+      if (self_index.find(entry.hash) != self_index.end())
+        continue;
+      entry.count += lminimum;
+      entry.error += lminimum;
+      entries.push_back(entry);
+    }
+
+    // Keep the largest counters only.
+    const size_t size = std::min(self_capacity, entries.size());
+    std::partial_sort(entries.begin(),
+                      entries.begin() + size,
+                      entries.end(),
+                      SpaceSaving::greater);
+    entries.resize(size);
+    this->clear();
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+      const Entry& entry = entries[i];
+      this->add_hash(entry.name.c_str(), entry.hash, entry.count, entry.error);
+    }
+    return true;
+  }
+
+
+  void
+  clear()
+  {
+    self_entry.clear();
+    self_heap.clear();
+    self_position.clear();
+    self_index.clear();
+  }
+
+
+  /**
+   * @brief Append serialized summary to the byte stream.
+   *
+   * Names are stored as UTF-16 code units.
+   */
+  void
+  serialize(std::vector<byte>& stream) const
+  {
+    Sketch::put32(stream, static_cast<uint32_t>(self_capacity));
+    Sketch::put64(stream, self_seed);
+    Sketch::put32(stream, static_cast<uint32_t>(self_entry.size()));
+    for (size_t i = 0; i < self_entry.size(); ++i)
+    {
+      const Entry& entry = self_entry[i];
+      Sketch::put64(stream, entry.hash);
+      Sketch::put64(stream, entry.count);
+      Sketch::put64(stream, entry.error);
+      Sketch::put32(stream, static_cast<uint32_t>(entry.name.size()));
+      for (size_t j = 0; j < entry.name.size(); ++j)
+      {
+        const uint16_t code = static_cast<uint16_t>(entry.name[j]);
+        stream.push_back(static_cast<byte>(code));
+        stream.push_back(static_cast<byte>(code >> 8));
+      }
+    }
+  }
+
+
+  /**
+   * @brief Read serialized summary from the byte stream.
+   *
+   * @return false if the stream is truncated or malformed
+   */
+  bool
+  deserialize(const byte*& buffer,
+              const byte* tail)
+  {
+    uint32_t capacity;
+    uint64_t seed;
+    uint32_t count;
+    if (!Sketch::get32(buffer, tail, capacity)
+    || !Sketch::get64(buffer, tail, seed)
+    || !Sketch::get32(buffer, tail, count))
+      return false;
+    if ((capacity == 0) || (count > capacity))
+      return false;
+    SpaceSaving summary(capacity, seed);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      Entry entry;
+      uint32_t length;
+      if (!Sketch::get64(buffer, tail, entry.hash)
+      || !Sketch::get64(buffer, tail, entry.count)
+      || !Sketch::get64(buffer, tail, entry.error)
+      || !Sketch::get32(buffer, tail, length))
+        return false;
+      if (static_cast<uint64_t>(tail - buffer) < (static_cast<uint64_t>(length) * 2))
+        return false;
+      entry.name.resize(length);
+      for (uint32_t j = 0; j < length; ++j)
+      {
+        uint16_t code = buffer[0];
+        code |= static_cast<uint16_t>(buffer[1] << 8);
+        entry.name[j] = static_cast<wchar_t>(code);
+        buffer += 2;
+      }
+      summary.add_hash(entry.name.c_str(), entry.hash, entry.count, entry.error);
+    }
+    *this = summary;
+    return true;
+  }
+};
+
+
+/**
+ * @brief HyperLogLog counter of distinct file names.
+ *
+ * Uses 2^precision one-byte registers; standard error is about
+ * 1.04 / sqrt(2^precision), e.g. 0.8% for the default precision 14.
+ */
+class HyperLogLog
+{
+private: // PRIVATE MEMBERS
+  uint32_t self_precision;
+  uint64_t self_seed;
+  std::vector<uint8_t> self_register;
+
+
+public: // CLASS FUNCTIONS
+  HyperLogLog(const uint32_t& precision = 14,
+              const uint64_t& seed = 0)
+  : self_precision(std::max<uint32_t>(4, std::min<uint32_t>(precision, 18)))
+  , self_seed(seed)
+  , self_register(static_cast<size_t>(1) << self_precision, 0)
+  {
+  }
+
+
+  /**
+   * @brief Register the given name.
+   */
+  void
+  add(const wchar_t* name)
+  {
+    this->add_hash(Sketch::hash(name, self_seed));
+  }
+
+
+  /**
+   * @brief Register the already hashed name.
+   */
+  void
+  add_hash(const uint64_t& code)
+  {
+    const size_t index = static_cast<size_t>(code >> (64 - self_precision));
+    uint64_t rest = (code << self_precision);
+    uint8_t rank = 1;
+    const uint8_t limit = static_cast<uint8_t>(64 - self_precision + 1);
+    while ((rank < limit) && !(rest >> 63))
+    {
+      rest <<= 1;
+      ++rank;
+    }
+    if (self_register[index] < rank)
+      self_register[index] = rank;
+  }
+
+
+  /**
+   * @brief Estimate number of distinct names.
+   */
+  double
+  estimate() const
+  {
+    const double size = static_cast<double>(self_register.size());
+    double alpha;
+    if (self_register.size() == 16)
+      alpha = 0.673;
+    else if (self_register.size() == 32)
+      alpha = 0.697;
+    else if (self_register.size() == 64)
+      alpha = 0.709;
+    else
+      alpha = (0.7213 / (1.0 + 1.079 / size));
+
+    double sum = 0.0;
+    size_t zeros = 0;
+    for (size_t i = 0; i < self_register.size(); ++i)
+    {
+      sum += ::ldexp(1.0, -static_cast<int>(self_register[i]));
+      if (self_register[i] == 0)
+        ++zeros;
+    }
+    double result = (alpha * size * size / sum);
+    if ((result <= (2.5 * size)) && (zeros != 0))
+      result = (size * ::log(size / static_cast<double>(zeros)));
+    return result;
+  }
+
+
+  inline uint32_t
+  precision() const
+  {
+    return self_precision;
+  }
+
+
+  inline uint64_t
+  seed() const
+  {
+    return self_seed;
+  }
+
+
+  /**
+   * @brief Merge another counter into this one.
+   *
+   * @return false if counters have different precision or seed
+   */
+  bool
+  merge(const HyperLogLog& other)
+  {
+    if ((self_precision != other.self_precision)
+    || (self_seed != other.self_seed))
+      return false;
+    for (size_t i = 0; i < self_register.size(); ++i)
+    {
+      if (self_register[i] < other.self_register[i])
+        self_register[i] = other.self_register[i];
+    }
+    return true;
+  }
+
+
+  void
+  clear()
+  {
+    std::fill(self_register.begin(), self_register.end(), 0);
+  }
+
+
+  /**
+   * @brief Append serialized counter to the byte stream.
+   */
+  void
+  serialize(std::vector<byte>& stream) const
+  {
+    Sketch::put32(stream, self_precision);
+    Sketch::put64(stream, self_seed);
+    stream.insert(stream.end(), self_register.begin(), self_register.end());
+  }
+
+
+  /**
+   * @brief Read serialized counter from the byte stream.
+   *
+   * @return false if the stream is truncated or malformed
+   */
+  bool
+  deserialize(const byte*& buffer,
+              const byte* tail)
+  {
+    uint32_t precision;
+    uint64_t seed;
+    if (!Sketch::get32(buffer, tail, precision)
+    || !Sketch::get64(buffer, tail, seed))
+      return false;
+    if ((precision < 4) || (precision > 18))
+      return false;
+    const size_t size = (static_cast<size_t>(1) << precision);
+    if (static_cast<size_t>(tail - buffer) < size)
+      return false;
+    self_precision = precision;
+    self_seed = seed;
+    self_register.assign(buffer, buffer + size);
+    buffer += size;
+    return true;
+  }
+};
+
+
+} // namespace winmenu
+#endif // WINAPPUSAGE_SKETCH_HPP
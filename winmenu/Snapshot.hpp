@@ -0,0 +1,608 @@
+/**
+ * @author    Dmitry Selyutin
+ * @copyright GNU General Public License v3.0+
+ */
+
+#ifndef WINAPPUSAGE_SNAPSHOT_HPP
+#define WINAPPUSAGE_SNAPSHOT_HPP
+#include "config.hpp"
+#include "stdint.hpp"
+#include "Status.hpp"
+#include "Usage.hpp"
+namespace winmenu {
+
+
+/**
+ * @brief Decoded Usage entries shared between processes.
+ *
+ * The single producer publishes snapshots into the named shared memory
+ * region (file mapping on Windows, POSIX shared memory on Winelib
+ * builds); any number of consumers attach to it and read entries in place.
+ * The region outlives the producer: a restarted producer reuses it, so
+ * attached consumers keep picking up new generations. If it restarts
+ * with another capacity, the old region is retired and consumers have to
+ * attach again. Use unlink to remove the name when the region is no
+ * longer needed.
+ *
+ * The region holds the header and two slots. Every slot contains the
+ * entry table followed by names and raw buffers; all references are
+ * offsets from the slot payload, so the region may be mapped at any
+ * address. The producer always writes the slot which is not current and
+ * then switches the generation. Every slot has its own sequence counter
+ * which is odd while the slot is written, so that readers detect that
+ * the data they looked at has been overwritten (seqlock).
+ *
+ * Consumers use it as follows:
+ * @code
+ * for (;;)
+ * {
+ *   const uint32_t token = snapshot.begin();
+ *   // read snapshot.size(), snapshot.name(i), ...
+ *   if (snapshot.validate(token))
+ *     break;
+ * }
+ * @endcode
+ */
+class Snapshot
+{
+private: // PRIVATE TYPES
+  struct Header
+  {
+    uint32_t magic;
+    uint32_t charsize;
+    uint64_t capacity;
+    volatile uint32_t generation;
+    uint32_t reserved;
+  };
+
+  struct Slot
+  {
+    volatile uint32_t sequence;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t used;
+  };
+
+  struct Entry
+  {
+    uint64_t time;
+    uint32_t counter;
+    uint32_t name;
+    uint32_t namesize;
+    uint32_t buffer;
+    uint32_t buffersize;
+    uint32_t reserved;
+  };
+
+
+private: // PRIVATE MEMBERS
+  byte* self_region;
+  size_t self_size;
+  bool self_writable;
+  const byte* self_payload;
+  const Slot* self_slot;
+  uint32_t self_generation;
+  uint64_t self_capacity;
+#if !defined(WINAPPUSAGE_POSIX)
+  HANDLE self_handle;
+#else
+  int self_handle;
+#endif
+
+
+public: // STATIC CONSTANTS
+  static const uint32_t MAGIC = 0x534E4D57; // "WMNS"
+
+
+public: // STATIC FUNCTIONS
+  /**
+   * @brief Remove the name of shared memory region.
+   *
+   * Mapped regions stay valid until every process detaches. Named file
+   * mappings on Windows are removed with their last handle, so there is
+   * nothing to do there.
+   */
+  static void
+  unlink(const char* name)
+  {
+#if defined(WINAPPUSAGE_POSIX)
+    ::shm_unlink(name);
+#else
+    (void)name;
+#endif
+  }
+
+
+private: // STATIC FUNCTIONS
+  /**
+   * @brief Full memory barrier.
+   */
+  static inline void
+  barrier()
+  {
+#if !defined(WINAPPUSAGE_POSIX)
+    ::MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+  }
+
+
+  static inline size_t
+  align(const size_t& size)
+  {
+    return ((size + 7) & ~static_cast<size_t>(7));
+  }
+
+
+private: // PRIVATE FUNCTIONS
+  inline Header*
+  header() const
+  {
+    return reinterpret_cast<Header*>(self_region);
+  }
+
+
+  inline Slot*
+  slot(uint32_t generation) const
+  {
+    const size_t slotsize = static_cast<size_t>(sizeof(Slot) + self_capacity);
+    byte* base = (self_region + Snapshot::align(sizeof(Header)));
+    return reinterpret_cast<Slot*>(base + (generation & 1) * slotsize);
+  }
+
+
+  inline const Entry&
+  entry(const size_t& index) const
+  {
+    return reinterpret_cast<const Entry*>(self_payload)[index];
+  }
+
+
+  /**
+   * @brief Map shared memory region of the given size.
+   */
+  Status
+  map(const char* name,
+      size_t size,
+      const bool& create)
+  {
+    this->detach();
+#if !defined(WINAPPUSAGE_POSIX)
+    if (create)
+    {
+      const uint64_t size64 = static_cast<uint64_t>(size);
+      self_handle = ::CreateFileMappingA(
+        INVALID_HANDLE_VALUE,                // page file backed
+        NULL,                                // security attributes
+        PAGE_READWRITE,                      // protection
+        static_cast<DWORD>(size64 >> 32),    // high size
+        static_cast<DWORD>(size64),          // low size
+        name);                               // mapping name
+    }
+    else
+      self_handle = ::OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    if (self_handle == NULL)
+      return Status(::GetLastError(), Status::STAGE_OPEN);
+    void* region = ::MapViewOfFile(
+      self_handle,
+      (create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ),
+      0,
+      0,
+      size);
+    if (region == NULL)
+    {
+      const DWORD state = ::GetLastError();
+      ::CloseHandle(self_handle);
+      self_handle = NULL;
+      return Status(state, Status::STAGE_OPEN);
+    }
+    if (size == 0)
+    {
+      // Mapping size is not known in advance for consumers.
+      size = static_cast<size_t>(reinterpret_cast<Header*>(region)->capacity);
+      size = (2 * (sizeof(Slot) + size) + Snapshot::align(sizeof(Header)));
+    }
+#else
+    const int flags = (create ? (O_CREAT | O_RDWR) : O_RDONLY);
+    self_handle = ::shm_open(name, flags, 0644);
+    if (self_handle < 0)
+      return Status(ERROR_FILE_NOT_FOUND, Status::STAGE_OPEN);
+    struct stat info;
+    if (::fstat(self_handle, &info) != 0)
+    {
+      this->detach();
+      return Status(ERROR_ACCESS_DENIED, Status::STAGE_OPEN);
+    }
+    const size_t existing = static_cast<size_t>(info.st_size);
+    if (create && (existing != 0) && (existing != size))
+    {
+      // Region of another capacity may still be mapped by consumers, so
+      // it is retired and replaced instead of being truncated.
+      if (existing >= sizeof(Header))
+      {
+        void* old = ::mmap(NULL, sizeof(Header), PROT_READ | PROT_WRITE,
+                           MAP_SHARED, self_handle, 0);
+        if (old != MAP_FAILED)
+        {
+          reinterpret_cast<Header*>(old)->magic = 0;
+          Snapshot::barrier();
+          ::munmap(old, sizeof(Header));
+        }
+      }
+      ::close(self_handle);
+      ::shm_unlink(name);
+      self_handle = ::shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+      if (self_handle < 0)
+        return Status(ERROR_ALREADY_EXISTS, Status::STAGE_OPEN);
+    }
+    if (create && (existing != size)
+    && (::ftruncate(self_handle, static_cast<off_t>(size)) != 0))
+    {
+      this->detach();
+      return Status(ERROR_NOT_ENOUGH_MEMORY, Status::STAGE_OPEN);
+    }
+    if (!create)
+      size = existing;
+    const int protection = (create ? (PROT_READ | PROT_WRITE) : PROT_READ);
+    void* region = ::mmap(NULL, size, protection, MAP_SHARED, self_handle, 0);
+    if (region == MAP_FAILED)
+    {
+      this->detach();
+      return Status(ERROR_NOT_ENOUGH_MEMORY, Status::STAGE_OPEN);
+    }
+#endif
+    self_region = static_cast<byte*>(region);
+    self_size = size;
+    self_writable = create;
+    return Status();
+  }
+
+
+public: // CLASS FUNCTIONS
+  Snapshot()
+  : self_region(NULL)
+  , self_size(0)
+  , self_writable(false)
+  , self_payload(NULL)
+  , self_slot(NULL)
+  , self_generation(0)
+  , self_capacity(0)
+#if !defined(WINAPPUSAGE_POSIX)
+  , self_handle(NULL)
+#else
+  , self_handle(-1)
+#endif
+  {
+  }
+
+
+  ~Snapshot()
+  {
+    this->detach();
+  }
+
+
+  /**
+   * @brief Create shared memory region as producer.
+   *
+   * @param name region name, e.g. "/winmenu" or "Local\\winmenu"
+   * @param capacity maximal size of the single snapshot in bytes
+   *
+   * Existing region of the same capacity is reused with its generation.
+   * Region of another capacity is retired (see retired) and replaced on
+   * Winelib builds; on Windows it cannot be replaced while consumers keep
+   * it open, so create fails with ERROR_ALREADY_EXISTS.
+   */
+  Status
+  create(const char* name,
+         const size_t& capacity = (16 << 20))
+  {
+    const size_t payload = Snapshot::align(capacity);
+    const size_t size = (Snapshot::align(sizeof(Header)) + 2 * (sizeof(Slot) + payload));
+    Status status = this->map(name, size, true);
+    if (!status.ok())
+      return status;
+    Header* header = this->header();
+    if ((header->magic == MAGIC)
+    && (header->charsize == sizeof(wchar_t))
+    && (header->capacity != payload))
+    {
+      this->detach();
+      return Status(ERROR_ALREADY_EXISTS, Status::STAGE_OPEN);
+    }
+    self_capacity = payload;
+    if ((header->magic == MAGIC)
+    && (header->charsize == sizeof(wchar_t)))
+    {
+      // Region of the previous producer; keep generation for consumers.
+      for (uint32_t i = 0; i < 2; ++i)
+      {
+        Slot* slot = this->slot(i);
+        if (slot->sequence & 1)
+          slot->sequence += 1;
+      }
+      Snapshot::barrier();
+      return status;
+    }
+    ::memset(self_region, 0, size);
+    header->charsize = sizeof(wchar_t);
+    header->capacity = payload;
+    header->generation = 0;
+    Snapshot::barrier();
+    header->magic = MAGIC;
+    return status;
+  }
+
+
+  /**
+   * @brief Attach to existing shared memory region as consumer.
+   */
+  Status
+  attach(const char* name)
+  {
+    Status status = this->map(name, 0, false);
+    if (!status.ok())
+      return status;
+    const Header* header = this->header();
+    if ((self_size < (Snapshot::align(sizeof(Header)) + 2 * sizeof(Slot)))
+    || (header->magic != MAGIC)
+    || (header->charsize != sizeof(wchar_t))
+    || (header->capacity > ((self_size - Snapshot::align(sizeof(Header))) / 2 - sizeof(Slot))))
+    {
+      this->detach();
+      return Status(ERROR_INVALID_DATA, Status::STAGE_OPEN);
+    }
+    self_capacity = header->capacity;
+    this->begin();
+    return status;
+  }
+
+
+  /**
+   * @brief Unmap the region; the region itself stays available.
+   */
+  void
+  detach()
+  {
+#if !defined(WINAPPUSAGE_POSIX)
+    if (self_region)
+      ::UnmapViewOfFile(self_region);
+    if (self_handle)
+      ::CloseHandle(self_handle);
+    self_handle = NULL;
+#else
+    if (self_region)
+      ::munmap(self_region, self_size);
+    if (self_handle >= 0)
+      ::close(self_handle);
+    self_handle = -1;
+#endif
+    self_region = NULL;
+    self_size = 0;
+    self_writable = false;
+    self_payload = NULL;
+    self_slot = NULL;
+    self_generation = 0;
+    self_capacity = 0;
+  }
+
+
+  /**
+   * @brief Publish entries of Usage as the next generation.
+   *
+   * Fails with ERROR_NOT_ENOUGH_MEMORY if entries exceed the capacity;
+   * the current generation stays visible in that case.
+   */
+  Status
+  publish(const Usage& usage)
+  {
+    if (!self_region || !self_writable)
+      return Status(ERROR_INVALID_HANDLE, Status::STAGE_WRITE);
+    Header* header = this->header();
+    const size_t count = usage.size();
+
+    // Calculate offsets before touching the slot.
+    size_t used = Snapshot::align(count * sizeof(Entry));
+    std::vector<size_t> names(count);
+    std::vector<size_t> sizes(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+      names[i] = static_cast<size_t>(::lstrlenW(usage.name(i)));
+      sizes[i] = used;
+      used += Snapshot::align((names[i] + 1) * sizeof(wchar_t));
+      used += Snapshot::align(usage.buffersize(i));
+    }
+    if ((used > self_capacity) || (used > UINT32_MAX))
+      return Status(ERROR_NOT_ENOUGH_MEMORY, Status::STAGE_WRITE);
+
+    // Write the slot which is not current.
+    const uint32_t generation = (header->generation + 1);
+    Slot* slot = this->slot(generation);
+    slot->sequence += 1;
+    Snapshot::barrier();
+    byte* payload = (reinterpret_cast<byte*>(slot) + sizeof(Slot));
+    Entry* entries = reinterpret_cast<Entry*>(payload);
+    for (size_t i = 0; i < count; ++i)
+    {
+      Entry& entry = entries[i];
+      entry.time = usage.stamp(i);
+      entry.counter = static_cast<uint32_t>(usage.counter(i));
+      entry.name = static_cast<uint32_t>(sizes[i]);
+      entry.namesize = static_cast<uint32_t>(names[i]);
+      entry.buffer = static_cast<uint32_t>(sizes[i] +
+        Snapshot::align((names[i] + 1) * sizeof(wchar_t)));
+      entry.buffersize = static_cast<uint32_t>(usage.buffersize(i));
+      entry.reserved = 0;
+      ::memcpy(payload + entry.name, usage.name(i), (names[i] + 1) * sizeof(wchar_t));
+      ::memcpy(payload + entry.buffer, usage.buffer(i), entry.buffersize);
+    }
+    slot->count = count;
+    slot->used = used;
+    Snapshot::barrier();
+    slot->sequence += 1;
+    Snapshot::barrier();
+    header->generation = generation;
+    return Status();
+  }
+
+
+  /**
+   * @brief Select the current generation for reading.
+   *
+   * @return token to be passed to validate
+   */
+  uint32_t
+  begin()
+  {
+    const Header* header = this->header();
+    for (;;)
+    {
+      const uint32_t generation = header->generation;
+      Snapshot::barrier();
+      const Slot* slot = this->slot(generation);
+      const uint32_t sequence = slot->sequence;
+      Snapshot::barrier();
+      if (sequence & 1)
+        continue;
+      self_slot = slot;
+      self_generation = generation;
+      self_payload = (reinterpret_cast<const byte*>(slot) + sizeof(Slot));
+      return sequence;
+    }
+  }
+
+
+  /**
+   * @brief Check that data read since begin was not overwritten.
+   */
+  inline bool
+  validate(const uint32_t& token) const
+  {
+    Snapshot::barrier();
+    return (self_slot->sequence == token);
+  }
+
+
+  /**
+   * @brief Check whether the region has been replaced by the producer.
+   *
+   * Data of the retired region stays readable but is never updated, so
+   * the consumer has to detach and attach again.
+   */
+  inline bool
+  retired() const
+  {
+    const Header* header = this->header();
+    return ((header->magic != MAGIC) || (header->capacity != self_capacity));
+  }
+
+
+  /**
+   * @brief Check whether the producer has published newer generation.
+   *
+   * Also true for the retired region.
+   */
+  inline bool
+  stale() const
+  {
+    return (this->retired() || (this->header()->generation != self_generation));
+  }
+
+
+  /**
+   * @brief Generation selected by the last begin call.
+   */
+  inline uint32_t
+  generation() const
+  {
+    return self_generation;
+  }
+
+
+  inline size_t
+  size() const
+  {
+    return static_cast<size_t>(self_slot->count);
+  }
+
+
+  /**
+   * @brief Retrieve name for the given index.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline const wchar_t*
+  name(const size_t& index) const
+  {
+    return reinterpret_cast<const wchar_t*>(self_payload + this->entry(index).name);
+  }
+
+
+  /**
+   * @brief Retrieve buffer for the given index.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline const byte*
+  buffer(const size_t& index) const
+  {
+    return (self_payload + this->entry(index).buffer);
+  }
+
+
+  inline size_t
+  buffersize(const size_t& index) const
+  {
+    return this->entry(index).buffersize;
+  }
+
+
+  /**
+   * @brief Retrieve already decoded counter for the given index.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline int32_t
+  counter(const size_t& index) const
+  {
+    return static_cast<int32_t>(this->entry(index).counter);
+  }
+
+
+  /**
+   * @brief Retrieve already decoded time stamp for the given index.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline time_t
+  time(const size_t& index,
+       FILETIME& filetime) const
+  {
+    const uint64_t stamp = this->entry(index).time;
+    filetime.dwLowDateTime = static_cast<DWORD>(stamp);
+    filetime.dwHighDateTime = static_cast<DWORD>(stamp >> 32);
+    return static_cast<time_t>(stamp);
+  }
+
+
+  /**
+   * @brief Retrieve time stamp for the given index as FILETIME ticks.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline uint64_t
+  stamp(const size_t& index) const
+  {
+    return this->entry(index).time;
+  }
+
+
+private:
+  Snapshot(const Snapshot&);
+  Snapshot& operator=(const Snapshot&);
+};
+
+
+} // namespace winmenu
+#endif // WINAPPUSAGE_SNAPSHOT_HPP
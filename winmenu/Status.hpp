@@ -0,0 +1,130 @@
+/**
+ * @author    Dmitry Selyutin
+ * @copyright GNU General Public License v3.0+
+ */
+
+#ifndef WINAPPUSAGE_STATUS_HPP
+#define WINAPPUSAGE_STATUS_HPP
+#include "config.hpp"
+#include "stdint.hpp"
+#include "WinError.hpp"
+namespace winmenu {
+
+
+/**
+ * @brief Compact non-throwing error description.
+ *
+ * Status is a plain value: creating and copying it never allocates.
+ * Error message is formatted only when requested and cached per code.
+ */
+class Status
+{
+public: // PUBLIC TYPES
+  /**
+   * @brief Operation which caused the failure.
+   */
+  enum Stage
+  {
+    STAGE_NONE = 0,
+    STAGE_OPEN,
+    STAGE_QUERY,
+    STAGE_ENUMERATE,
+    STAGE_DECODE,
+    STAGE_WRITE
+  };
+
+
+private: // PRIVATE MEMBERS
+  DWORD self_code;
+  uint16_t self_stage;
+  uint16_t self_key;
+  uint32_t self_index;
+
+
+public: // CLASS FUNCTIONS
+  Status()
+  : self_code(ERROR_SUCCESS)
+  , self_stage(STAGE_NONE)
+  , self_key(0)
+  , self_index(0)
+  {
+  }
+
+
+  /**
+   * @param code Windows error code
+   * @param stage operation which failed
+   * @param key index of registry key
+   * @param index index of registry value inside key
+   */
+  Status(const DWORD& code,
+         const Stage& stage,
+         const size_t& key = 0,
+         const size_t& index = 0)
+  : self_code(code)
+  , self_stage(static_cast<uint16_t>(stage))
+  , self_key(static_cast<uint16_t>(key))
+  , self_index(static_cast<uint32_t>(index))
+  {
+  }
+
+
+  inline bool
+  ok() const
+  {
+    return (self_code == ERROR_SUCCESS);
+  }
+
+
+  inline DWORD
+  code() const
+  {
+    return self_code;
+  }
+
+
+  inline Stage
+  stage() const
+  {
+    return static_cast<Stage>(self_stage);
+  }
+
+
+  inline size_t
+  key() const
+  {
+    return self_key;
+  }
+
+
+  inline size_t
+  index() const
+  {
+    return self_index;
+  }
+
+
+  /**
+   * @brief Retrieve cached system message for the error code.
+   */
+  inline const char*
+  message() const
+  {
+    return WinError::format(self_code);
+  }
+
+
+  /**
+   * @brief Throw WinError if status describes failure.
+   */
+  inline void
+  raise() const
+  {
+    if (self_code != ERROR_SUCCESS)
+      throw WinError(self_code);
+  }
+};
+
+
+} // namespace winmenu
+#endif // WINAPPUSAGE_STATUS_HPP
@@ -0,0 +1,332 @@
+/**
+ * @author    Dmitry Selyutin
+ * @copyright GNU General Public License v3.0+
+ */
+
+#ifndef WINAPPUSAGE_TIMEINDEX_HPP
+#define WINAPPUSAGE_TIMEINDEX_HPP
+#include "config.hpp"
+#include "stdint.hpp"
+#include "Usage.hpp"
+namespace winmenu {
+
+
+/**
+ * @brief Secondary index of entries sorted by last access time.
+ *
+ * Items are kept in sorted blocks of bounded size together with the array
+ * of the first item of every block, like the leaf level of a B+-tree.
+ * Lookups perform binary search over the block heads and then inside the
+ * single block; insertion and removal touch only one block. Blocks are
+ * allocated separately, so that splitting or dropping a block moves only
+ * pointers. Time stamps are FILETIME ticks as returned by Usage::stamp.
+ */
+class TimeIndex
+{
+private: // PRIVATE TYPES
+  struct Item
+  {
+    uint64_t time;
+    size_t id;
+
+    inline bool
+    operator<(const Item& other) const
+    {
+      if (time != other.time)
+        return (time < other.time);
+      return (id < other.id);
+    }
+  };
+
+
+private: // PRIVATE MEMBERS
+  size_t self_size;
+  std::vector<Item> self_head;
+  std::vector<std::vector<Item>*> self_block;
+  std::vector<uint64_t> self_time;
+  std::vector<bool> self_present;
+
+
+public: // STATIC CONSTANTS
+  static const size_t BLOCK = 128;
+
+
+private: // PRIVATE FUNCTIONS
+  static inline Item
+  item(const uint64_t& time,
+       const size_t& id)
+  {
+    Item result;
+    result.time = time;
+    result.id = id;
+    return result;
+  }
+
+
+  /**
+   * @brief Find position of the first item not less than key.
+   */
+  void
+  locate(const Item& key,
+         size_t& block,
+         size_t& index) const
+  {
+    block = static_cast<size_t>(
+      std::upper_bound(self_head.begin(), self_head.end(), key)
+      - self_head.begin());
+    if (block != 0)
+      --block;
+    index = 0;
+    if (block == self_block.size())
+      return;
+    const std::vector<Item>& items = *self_block[block];
+    index = static_cast<size_t>(
+      std::lower_bound(items.begin(), items.end(), key) - items.begin());
+    if (index == items.size())
+    {
+      ++block;
+      index = 0;
+    }
+  }
+
+
+  /**
+   * @brief Append ids from the given position while time is before until.
+   */
+  void
+  collect(size_t block,
+          size_t index,
+          const uint64_t& until,
+          std::vector<size_t>& result) const
+  {
+    for (; block < self_block.size(); ++block, index = 0)
+    {
+      const std::vector<Item>& items = *self_block[block];
+      for (; index < items.size(); ++index)
+      {
+        if (items[index].time >= until)
+          return;
+        result.push_back(items[index].id);
+      }
+    }
+  }
+
+
+public: // CLASS FUNCTIONS
+  TimeIndex()
+  : self_size(0)
+  {
+  }
+
+
+  ~TimeIndex()
+  {
+    this->clear();
+  }
+
+
+  inline size_t
+  size() const
+  {
+    return self_size;
+  }
+
+
+  /**
+   * @brief Insert entry with the given id and time.
+   *
+   * If the entry is already indexed, its time is updated.
+   */
+  void
+  insert(const size_t& id,
+         const uint64_t& time)
+  {
+    if ((id < self_present.size()) && self_present[id])
+    {
+      if (self_time[id] == time)
+        return;
+      this->erase(id);
+    }
+    if (id >= self_present.size())
+    {
+      self_time.resize(id + 1, 0);
+      self_present.resize(id + 1, false);
+    }
+    self_time[id] = time;
+    self_present[id] = true;
+    ++self_size;
+
+    const Item key = TimeIndex::item(time, id);
+    if (self_block.empty())
+    {
+      self_block.push_back(new std::vector<Item>(1, key));
+      self_head.push_back(key);
+      return;
+    }
+    size_t block = static_cast<size_t>(
+      std::upper_bound(self_head.begin(), self_head.end(), key)
+      - self_head.begin());
+    if (block != 0)
+      --block;
+    std::vector<Item>& items = *self_block[block];
+    items.insert(std::lower_bound(items.begin(), items.end(), key), key);
+    self_head[block] = items.front();
+
+    // Split overflowing block in halves.
+    if (items.size() > (2 * BLOCK))
+    {
+      std::vector<Item>* upper = new std::vector<Item>(items.begin() + BLOCK, items.end());
+      items.resize(BLOCK);
+      self_head.insert(self_head.begin() + block + 1, upper->front());
+      self_block.insert(self_block.begin() + block + 1, upper);
+    }
+  }
+
+
+  /**
+   * @brief Remove entry with the given id if it is indexed.
+   */
+  void
+  erase(const size_t& id)
+  {
+    if ((id >= self_present.size()) || !self_present[id])
+      return;
+    size_t block;
+    size_t index;
+    this->locate(TimeIndex::item(self_time[id], id), block, index);
+    self_present[id] = false;
+    --self_size;
+    std::vector<Item>& items = *self_block[block];
+    items.erase(items.begin() + index);
+    if (items.empty())
+    {
+      delete self_block[block];
+      self_head.erase(self_head.begin() + block);
+      self_block.erase(self_block.begin() + block);
+    }
+    else
+      self_head[block] = items.front();
+  }
+
+
+  /**
+   * @brief Bring the index in sync with Usage entries.
+   *
+   * Time of every entry is decoded, so this is a full pass over Usage;
+   * only entries whose time has changed are moved. Ids are Usage indices.
+   */
+  void
+  sync(const Usage& usage)
+  {
+    const size_t size = usage.size();
+    for (size_t id = 0; id < size; ++id)
+      this->insert(id, usage.stamp(id));
+    for (size_t id = size; id < self_present.size(); ++id)
+      this->erase(id);
+    self_time.resize(size);
+    self_present.resize(size);
+  }
+
+
+  void
+  clear()
+  {
+    for (size_t i = 0; i < self_block.size(); ++i)
+      delete self_block[i];
+    self_size = 0;
+    self_head.clear();
+    self_block.clear();
+    self_time.clear();
+    self_present.clear();
+  }
+
+
+  /**
+   * @brief Retrieve ids with time in [since, until), oldest first.
+   */
+  void
+  range(const uint64_t& since,
+        const uint64_t& until,
+        std::vector<size_t>& result) const
+  {
+    result.clear();
+    if (since >= until)
+      return;
+    size_t block;
+    size_t index;
+    this->locate(TimeIndex::item(since, 0), block, index);
+    this->collect(block, index, until, result);
+  }
+
+
+  /**
+   * @brief Retrieve ids with time not less than since, oldest first.
+   */
+  void
+  since(const uint64_t& since,
+        std::vector<size_t>& result) const
+  {
+    result.clear();
+    size_t block;
+    size_t index;
+    this->locate(TimeIndex::item(since, 0), block, index);
+    for (; block < self_block.size(); ++block, index = 0)
+    {
+      const std::vector<Item>& items = *self_block[block];
+      for (; index < items.size(); ++index)
+        result.push_back(items[index].id);
+    }
+  }
+
+
+  /**
+   * @brief Retrieve ids with time less than until, oldest first.
+   */
+  void
+  until(const uint64_t& until,
+        std::vector<size_t>& result) const
+  {
+    result.clear();
+    this->collect(0, 0, until, result);
+  }
+
+
+  /**
+   * @brief Retrieve up to count most recently used ids, newest first.
+   */
+  void
+  recent(const size_t& count,
+         std::vector<size_t>& result) const
+  {
+    result.clear();
+    size_t block = self_block.size();
+    while ((block != 0) && (result.size() < count))
+    {
+      const std::vector<Item>& items = *self_block[--block];
+      size_t index = items.size();
+      while ((index != 0) && (result.size() < count))
+        result.push_back(items[--index].id);
+    }
+  }
+
+
+  /**
+   * @brief Retrieve indexed time of the given id.
+   *
+   * @WARNING This function doesn't check id leaving it up to user.
+   */
+  inline uint64_t
+  time(const size_t& id) const
+  {
+    return self_time[id];
+  }
+
+
+private:
+  TimeIndex(const TimeIndex&);
+  TimeIndex& operator=(const TimeIndex&);
+};
+
+
+} // namespace winmenu
+#endif // WINAPPUSAGE_TIMEINDEX_HPP
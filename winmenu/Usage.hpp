@@ -8,6 +8,8 @@
 #include "config.hpp"
 #include "stdint.hpp"
 #include "WinError.hpp"
+#include "Status.hpp"
+#include "Sketch.hpp"
 namespace winmenu {
 
 
@@ -17,14 +19,233 @@ namespace winmenu {
  * Since there is no need to create multiple objects of Usage type,
  * it is implemented as singleton. If there is actual need to refresh
  * registry keys and values, update function must be called.
+ *
+ * Long-running consumers may bound memory with a retention policy (see
+ * retain): only the working set is kept, while all other entries are
+ * reduced to 64 bit fingerprints of their names and can be reloaded from
+ * the registry on demand.
  */
 class Usage
 {
+public: // PUBLIC TYPES
+  /**
+   * @brief Rule which selects entries of the working set.
+   */
+  enum Retention
+  {
+    RETAIN_ALL = 0,
+    RETAIN_COUNTER,
+    RETAIN_RECENT
+  };
+
+
+private: // PRIVATE TYPES
+  struct Policy
+  {
+    Retention mode;
+    size_t count;
+    size_t bytes;
+  };
+
+
 private: // PRIVATE MEMBERS
   size_t self_count;
   wchar_t** self_name;
   byte** self_buffer;
   size_t* self_buffersize;
+  std::vector<uint64_t> self_fingerprint;
+  bool self_registry;
+
+
+private: // PRIVATE FUNCTIONS
+  /**
+   * @brief Release all entries.
+   */
+  void
+  clear()
+  {
+    for (size_t i = 0; i < self_count; ++i)
+    {
+      delete[] self_name[i];
+      delete[] self_buffer[i];
+    }
+    delete[] self_name;
+    delete[] self_buffer;
+    delete[] self_buffersize;
+    self_count = 0;
+    self_name = NULL;
+    self_buffer = NULL;
+    self_buffersize = NULL;
+  }
+
+
+  /**
+   * @brief Reduce collected entries to the working set.
+   *
+   * @param bytes footprint of collected entries; updated on return
+   * @param force trim right now instead of waiting for twice the limit
+   *
+   * Trimming while entries are still being collected is amortized: it is
+   * postponed until the list grows twice as large as allowed, so that the
+   * peak memory stays bounded and every entry is ranked O(1) times on
+   * average. Evicted entries leave only the fingerprint of their name.
+   */
+  void
+  trim(std::vector<wchar_t*>& names,
+       std::vector<byte*>& buffers,
+       std::vector<size_t>& sizes,
+       size_t& bytes,
+       const bool& force)
+  {
+    const Policy& policy = Usage::policy();
+    if (policy.mode == RETAIN_ALL)
+      return;
+    const size_t count = (policy.count ? policy.count : SIZE_MAX);
+    const size_t budget = (policy.bytes ? policy.bytes : SIZE_MAX);
+    if ((names.size() <= count) && (bytes <= budget))
+      return;
+    if (!force && ((names.size() / 2) < count) && ((bytes / 2) < budget))
+      return;
+
+    // Rank entries, the most valuable first.
+    std::vector<std::pair<uint64_t, size_t> > rank(names.size());
+    for (size_t index = 0; index < names.size(); ++index)
+    {
+      uint64_t time;
+      uint32_t counter;
+      const size_t size = sizes[index];
+      Usage::import_data(buffers[index], size, counter, time, Usage::layout(size));
+      rank[index].first = (policy.mode == RETAIN_COUNTER)
+        ? static_cast<uint64_t>(counter)
+        : time;
+      rank[index].second = (SIZE_MAX - index);
+    }
+    std::sort(rank.begin(), rank.end());
+
+    // Keep the best entries while both limits hold.
+    size_t kept = 0;
+    size_t used = 0;
+    std::vector<bool> keep(names.size(), false);
+    for (size_t i = rank.size(); i != 0; --i)
+    {
+      const size_t index = (SIZE_MAX - rank[i - 1].second);
+      const size_t entry = Usage::footprint(names[index], sizes[index]);
+      if ((kept == count) || (entry > (budget - used)))
+        break;
+      keep[index] = true;
+      used += entry;
+      ++kept;
+    }
+
+    // Compact lists preserving the registry order.
+    size_t tail = 0;
+    for (size_t index = 0; index < names.size(); ++index)
+    {
+      if (!keep[index])
+      {
+        self_fingerprint.push_back(Sketch::hash(names[index]));
+        delete[] names[index];
+        delete[] buffers[index];
+        continue;
+      }
+      names[tail] = names[index];
+      buffers[tail] = buffers[index];
+      sizes[tail] = sizes[index];
+      ++tail;
+    }
+    names.resize(tail);
+    buffers.resize(tail);
+    sizes.resize(tail);
+    bytes = used;
+  }
+
+
+  /**
+   * @brief Publish collected entries and sort fingerprints.
+   */
+  void
+  publish(const std::vector<wchar_t*>& names,
+          const std::vector<byte*>& buffers,
+          const std::vector<size_t>& sizes)
+  {
+    self_count = names.size();
+    if (self_count != 0)
+    {
+      self_name = new wchar_t*[self_count];
+      self_buffer = new byte*[self_count];
+      self_buffersize = new size_t[self_count];
+      std::copy(names.begin(), names.end(), self_name);
+      std::copy(buffers.begin(), buffers.end(), self_buffer);
+      std::copy(sizes.begin(), sizes.end(), self_buffersize);
+    }
+    std::sort(self_fingerprint.begin(), self_fingerprint.end());
+    self_fingerprint.erase(
+      std::unique(self_fingerprint.begin(), self_fingerprint.end()),
+      self_fingerprint.end());
+  }
+
+
+private: // STATIC FUNCTIONS
+  /**
+   * @brief Retrieve retention policy shared by all updates.
+   */
+  static Policy&
+  policy()
+  {
+    static Policy self_policy = {RETAIN_ALL, 0, 0};
+    return self_policy;
+  }
+
+
+  /**
+   * @brief Retrieve number of bytes occupied by the single entry.
+   */
+  static inline size_t
+  footprint(const wchar_t* name,
+            const size_t& size)
+  {
+    return (((static_cast<size_t>(::lstrlenW(name)) + 1) * sizeof(wchar_t)) + size);
+  }
+
+
+  /**
+   * @brief Calculate paths of UserAssist Count keys for this platform.
+   */
+  static void
+  count_paths(std::vector<std::wstring>& paths)
+  {
+    paths.clear();
+
+    // Determine registry keys.
+    bool windows7 = (Usage::layout() == LAYOUT_WIN7);
+    const wchar_t* keys[3];
+    if (!windows7)
+    {
+      keys[0] = L"{0D6D4F41-2994-4BA0-8FEF-620E43CD2812}";
+      keys[1] = L"{5E6AB780-7743-11CF-A12B-00AA004AE837}";
+      keys[2] = L"{75048700-EF1F-11D0-9888-006097DEACF9}";
+    }
+    else
+    {
+      keys[0] = L"{CEBFF5CD-ACE2-4F4F-9178-9926F41749EA}";
+      keys[1] = L"{F4E57C4B-2036-45F0-A9AB-443BCFE33D9F}";
+      keys[2] = NULL;
+    }
+
+    // Calculate registry paths.
+    const wchar_t* headstr = L"Software\\Microsoft\\Windows\\CurrentVersion\\Explorer\\UserAssist\\";
+    const wchar_t* tailstr = L"\\Count\\";
+    for (size_t i = 0; i < 3; ++i)
+    {
+      if (!keys[i])
+        break;
+      std::wstring str;
+      str += headstr;
+      str += keys[i];
+      str += tailstr;
+      paths.push_back(str);
+    }
+  }
 
 
 public: // STATIC FUNCTIONS
@@ -41,6 +262,29 @@ public: // STATIC FUNCTIONS
   }
 
 
+  /**
+   * @brief Set retention policy for all subsequent updates.
+   *
+   * @param mode rank entries by counter or by last access time
+   * @param count maximal number of entries kept, 0 means unlimited
+   * @param bytes maximal size of names and buffers kept, 0 means unlimited
+   *
+   * Call before the first instance() to bound the initial load as well.
+   * Entries are ranked by mode and the best ones are kept while both
+   * limits hold; all other entries are kept only as fingerprints.
+   */
+  static void
+  retain(const Retention& mode,
+         const size_t& count,
+         const size_t& bytes = 0)
+  {
+    Policy& policy = Usage::policy();
+    policy.mode = mode;
+    policy.count = count;
+    policy.bytes = bytes;
+  }
+
+
   /**
    * @brief Retrieve Windows version as 32 bit integer.
    */
@@ -105,13 +349,88 @@ public: // STATIC FUNCTIONS
   }
 
 
+  /**
+   * @brief Binary layout of UserAssist values.
+   *
+   * Windows XP and Vista use 16 byte records with time stamp at offset 8,
+   * Windows 7 and newer use 72 byte records with time stamp at offset 60.
+   */
+  enum Layout
+  {
+    LAYOUT_AUTO = 0,
+    LAYOUT_XP,
+    LAYOUT_WIN7
+  };
+
+
+  /**
+   * @brief Retrieve layout used by the running system.
+   */
+  static inline Layout
+  layout()
+  {
+    static Layout self_layout;
+    if (self_layout == LAYOUT_AUTO)
+    {
+      uint32_t version = platform();
+      uint16_t major = static_cast<uint16_t>(version >> 16);
+      uint16_t minor = static_cast<uint16_t>(version);
+      bool windows7 = ((major > 6) || ((major == 6) && (minor >= 1)));
+      self_layout = (windows7 ? LAYOUT_WIN7 : LAYOUT_XP);
+    }
+    return self_layout;
+  }
+
+
+  /**
+   * @brief Guess layout of the record by its size.
+   *
+   * Records which come from hive files may belong to another Windows
+   * version, so their size is more reliable than the running system.
+   */
+  static inline Layout
+  layout(const size_t& size)
+  {
+    if (size >= 72)
+      return LAYOUT_WIN7;
+    else if (size >= 16)
+      return LAYOUT_XP;
+    return Usage::layout();
+  }
+
+
+  /**
+   * @brief Retrieve record size in bytes for the given layout.
+   */
+  static inline size_t
+  record_size(Layout layout)
+  {
+    if (layout == LAYOUT_AUTO)
+      layout = Usage::layout();
+    return ((layout == LAYOUT_WIN7) ? 72 : 16);
+  }
+
+
+  /**
+   * @brief Retrieve time stamp offset in bytes for the given layout.
+   */
+  static inline size_t
+  time_offset(Layout layout)
+  {
+    if (layout == LAYOUT_AUTO)
+      layout = Usage::layout();
+    return ((layout == LAYOUT_WIN7) ? 60 : 8);
+  }
+
+
   /**
    * @brief Read binary buffer and import counter and access time.
    * 
    * @param buffer pointer to binary buffer
    * @param size number of byte to read
    * @param counter number of times file was executed
-   * @param time last access time in time_t format
+   * @param time last access time as FILETIME ticks
+   * @param layout binary layout of the buffer
    * 
    * If import_data fails, then both counter and time are set to 0.
    */
@@ -119,20 +438,14 @@ public: // STATIC FUNCTIONS
   import_data(const byte* buffer,
               const size_t& size,
               uint32_t& counter,
-              time_t& time)
+              uint64_t& time,
+              const Layout& layout = LAYOUT_AUTO)
   {
     counter = 0;
     time = 0;
     if ((buffer == NULL) || (size == 0))
       return;
-
-    // Determine Windows version.
-    size_t offset = 0;
-    bool windows7 = false;
-    uint16_t major = Usage::platform_major();
-    uint16_t minor = Usage::platform_minor();
-    windows7 = ((major >= 6) && (minor >= 1));
-    offset = (windows7 ? 60 : 8);
+    const size_t offset = Usage::time_offset(layout);
     if (size < (offset + 8))
       return;
 
@@ -140,13 +453,6 @@ public: // STATIC FUNCTIONS
     byte32set set;
     uint64_t hpart;
     uint64_t lpart;
-#if (UINT64_MAX == ULONG_MAX)
-    const uint64_t ms2ns = 10000000UL;
-    const uint64_t diff = 116444736000000000UL;
-#else
-    const uint64_t ms2ns = 10000000ULL;
-    const uint64_t diff = 116444736000000000ULL;
-#endif
     buffer += 4;
     for (size_t i = 0; i < 4; ++i)
       set.bytes[i] = buffer[i];
@@ -155,13 +461,57 @@ public: // STATIC FUNCTIONS
     buffer += offset;
     for (size_t i = 0; i < 4; ++i)
       set.bytes[i] = buffer[i];
-    hpart = static_cast<uint32_t>(set.code);
+    lpart = static_cast<uint32_t>(set.code);
     buffer += 4;
     for (size_t i = 0; i < 4; ++i)
       set.bytes[i] = buffer[i];
-    lpart = static_cast<uint32_t>(set.code);
+    hpart = static_cast<uint32_t>(set.code);
     time = ((hpart << 32) | lpart);
-    // time = static_cast<time_t>((unixtime - diff) / ms2ns); // Unix
+  }
+
+
+  /**
+   * @brief Read binary buffer and import counter and access time.
+   *
+   * FILETIME ticks do not fit into 32 bit time_t; use the uint64_t
+   * overload where time_t may be 32 bit wide.
+   */
+  static void
+  import_data(const byte* buffer,
+              const size_t& size,
+              uint32_t& counter,
+              time_t& time,
+              const Layout& layout = LAYOUT_AUTO)
+  {
+    uint64_t stamp;
+    Usage::import_data(buffer, size, counter, stamp, layout);
+    time = static_cast<time_t>(stamp);
+  }
+
+
+  /**
+   * @brief Write record with the given counter and time into buffer.
+   *
+   * @param counter number of times file was executed
+   * @param time last access time as FILETIME ticks
+   * @param buffer pointer to at least record_size(layout) bytes
+   * @param layout binary layout of the record
+   *
+   * All fields other than counter and time are set to 0.
+   */
+  static void
+  encode_data(const uint32_t& counter,
+              const uint64_t& time,
+              byte* buffer,
+              const Layout& layout = LAYOUT_AUTO)
+  {
+    const size_t size = Usage::record_size(layout);
+    const size_t offset = Usage::time_offset(layout);
+    ::memset(buffer, 0, size);
+    for (size_t i = 0; i < 4; ++i)
+      buffer[4 + i] = static_cast<byte>(counter >> (i * 8));
+    for (size_t i = 0; i < 8; ++i)
+      buffer[offset + i] = static_cast<byte>(time >> (i * 8));
   }
 
 
@@ -169,113 +519,77 @@ public: // STATIC FUNCTIONS
    * @brief Initialize binary buffer with the given counter and time.
    * 
    * @param counter number of times file was executed
-   * @param time last access time in Unix format
-   * @param buffer pointer to binary buffer
+   * @param time last access time as FILETIME ticks
+   * @param buffer receives pointer to binary buffer allocated with new[]
    * @param size number of bytes written
+   * @param layout binary layout of the record
    * 
    * If export_data fails, then both buffer and size are set to 0.
+   * Use Encoder to produce many records without allocating each one.
    */
   static void
   export_data(const uint32_t& counter,
-              const time_t& time,
+              const uint64_t& time,
               byte** buffer,
-              size_t& size)
+              size_t& size,
+              const Layout& layout = LAYOUT_AUTO)
   {
-    buffer = NULL;
     size = 0;
+    if (buffer == NULL)
+      return;
+    *buffer = NULL;
     if ((counter == 0) || (time == 0))
       return;
-
-    // Determine Windows version.
-    size_t offset = 0;
-    bool windows7 = false;
-    const byte* byteptr = NULL;
-    uint16_t major = Usage::platform_major();
-    uint16_t minor = Usage::platform_minor();
-    windows7 = ((major >= 6) && (minor >= 1));
-    offset = (windows7 ? 60 : 8);
-
-    //
-    byte* iter = NULL;
-    size = (offset + 8);
+    size = Usage::record_size(layout);
     *buffer = new byte[size];
-    const byte* data = NULL;
-    ::memset(buffer, 0, size);
-    byteptr = reinterpret_cast<const byte*>(counter);
-    iter += 4;
-    for (size_t i = 0; i < 4; ++i)
-      iter[i] = byteptr[i];
-    byteptr = reinterpret_cast<const byte*>(time);
-    iter -= 4;
-    iter += (offset);
-    for (size_t i = 0; i < 8; ++i)
-      iter[i] = byteptr[i];
+    Usage::encode_data(counter, time, *buffer, layout);
   }
 
 
 public: // CLASS FUNCTIONS
   /**
-   * @brief Refresh all data from registry.
+   * @brief Refresh all data from registry without throwing.
+   *
+   * @param errors list which receives every failure
+   *
+   * Registry keys or values which cannot be read are skipped and reported
+   * via errors; all other entries are still loaded. Returns the first
+   * failure or success if there were no failures at all.
    */
-  void
-  update()
+  Status
+  try_update(std::vector<Status>& errors)
   {
-    self_count = 0;
-    delete[] self_name;
-    delete[] self_buffer;
-    delete[] self_buffersize;
+    this->clear();
+    errors.clear();
+    self_fingerprint.clear();
+    self_registry = true;
     DWORD state = ERROR_SUCCESS;
-    
-    // Determine registry keys.
-    bool windows7 = false;
-    uint16_t major = platform_major();
-    uint16_t minor = platform_minor();
-    windows7 = ((major >= 6) && (minor >= 1));
-    const wchar_t* keys[3];
-    if (!windows7)
-    {
-      keys[0] = L"{0D6D4F41-2994-4BA0-8FEF-620E43CD2812}";
-      keys[1] = L"{5E6AB780-7743-11CF-A12B-00AA004AE837}";
-      keys[2] = L"{75048700-EF1F-11D0-9888-006097DEACF9}";
-    }
-    else
-    {
-      keys[0] = L"{CEBFF5CD-ACE2-4F4F-9178-9926F41749EA}";
-      keys[1] = L"{F4E57C4B-2036-45F0-A9AB-443BCFE33D9F}";
-      keys[2] = NULL;
-    }
-
-    // Calculate registry paths.
     std::vector<std::wstring> paths;
-    const wchar_t* headstr = L"Software\\Microsoft\\Windows\\CurrentVersion\\Explorer\\UserAssist\\";
-    const wchar_t* tailstr = L"\\Count\\";
-    for (size_t i = 0; i < 3; ++i)
-    {
-      if (!keys[i])
-        break;
-      std::wstring str;
-      str += headstr;
-      str += keys[i];
-      str += tailstr;
-      paths.push_back(str);
-    }
+    Usage::count_paths(paths);
 
     // Iterate over registry paths.
-    std::vector<std::wstring>::const_iterator iter = paths.begin();
-    std::vector<std::wstring>::const_iterator tail = paths.end();
-    while (iter < tail)
+    std::vector<wchar_t*> names;
+    std::vector<byte*> buffers;
+    std::vector<size_t> sizes;
+    size_t bytes = 0;
+    for (size_t keyindex = 0; keyindex < paths.size(); ++keyindex)
     {
       HKEY handle;
-      std::wstring key = *iter;
+      const std::wstring& key = paths[keyindex];
 
       // Open registry handle.
       DWORD access = (KEY_READ | KEY_ENUMERATE_SUB_KEYS | KEY_QUERY_VALUE);
       state = ::RegOpenKeyExW(
         HKEY_CURRENT_USER,
-        &key[0],    // address of key to open
+        key.c_str(), // address of key to open
         0,          // reserved parameter
         access,     // desired access rights
         &handle);   // address of handle of open key
+      if (state != ERROR_SUCCESS)
+      {
+        errors.push_back(Status(state, Status::STAGE_OPEN, keyindex));
+        continue;
+      }
 
       // Query registry information.
       DWORD values;
@@ -295,62 +609,229 @@ public: // CLASS FUNCTIONS
         NULL,           // security descriptor 
         NULL);          // last write time
       if (state != ERROR_SUCCESS)
-        throw WinError(state);
-
-      // Enumerate registry values.
-      self_count = values;
-      self_name = new wchar_t*[values];
-      self_buffer = new byte*[values];
-      self_buffersize = new size_t[values];
-      for (DWORD index = 0; index < self_count; ++index)
       {
-        // Retrieve necessary data.
-        DWORD datalen = 128;
-        DWORD valuelen = 64;
+        errors.push_back(Status(state, Status::STAGE_QUERY, keyindex));
+        ::RegCloseKey(handle);
+        continue;
+      }
+
+      // Enumerate registry values using the single pair of buffers.
+      std::vector<byte> data(maxdatalen + 1);
+      std::vector<wchar_t> value(maxvaluelen + 1);
+      for (DWORD index = 0; index < values; ++index)
+      {
+        DWORD datalen = static_cast<DWORD>(data.size());
+        DWORD valuelen = static_cast<DWORD>(value.size());
         DWORD datatype = REG_BINARY;
-        byte* data = NULL;
-        wchar_t* value = NULL;
-        state = ERROR_MORE_DATA;
-        DWORD maxdata;
-        while (state == ERROR_MORE_DATA)
+        state = ::RegEnumValueW(
+          handle,
+          index,         // current index
+          &value[0],     // pointer to name
+          &valuelen,     // maximal name length
+          NULL,          // reserved parameter
+          &datatype,     // type of data
+          &data[0],      // pointer to buffer
+          &datalen);     // maximal buffer length
+        if (state == ERROR_NO_MORE_ITEMS)
+          break;
+        if (state == ERROR_MORE_DATA)
         {
-          data = new byte[datalen];
-          value = new wchar_t[valuelen];
-          state = ::RegEnumValueW(
-            handle,
-            index,         // current index
-            value,         // pointer to name
-            &valuelen,     // maximal name length
-            NULL,          // reserved parameter
-            &datatype,     // type of data
-            data,          // pointer to buffer
-            &datalen);     // maximal buffer length
-          if (state == ERROR_SUCCESS)
-            break;
-          ++datalen;
-          ++valuelen;
-          if (datalen > maxdata)
-            maxdata = datalen;
-          delete[] data;
-          delete[] value;
+          // Value has grown since RegQueryInfoKey; enlarge buffers and retry.
+          data.resize(std::max<size_t>(datalen + 1, 2 * data.size()));
+          value.resize(std::max<size_t>(valuelen + 1, 2 * value.size()));
+          --index;
+          continue;
         }
         if (state != ERROR_SUCCESS)
-          throw WinError(state);
+        {
+          errors.push_back(Status(state, Status::STAGE_ENUMERATE, keyindex, index));
+          continue;
+        }
 
         // Append data to lists.
-        self_name[index] = new wchar_t[++valuelen];
-        self_name[index][--valuelen] = 0;
+        wchar_t* name = new wchar_t[valuelen + 1];
+        name[valuelen] = 0;
         for (DWORD i = 0; i < valuelen; ++i)
-          self_name[index][i] = Usage::ROT13(value[i]);
-        self_buffer[index] = new byte[datalen];
-        ::memcpy(self_buffer[index], data, datalen);
-        self_buffersize[index] = datalen;
-        delete[] data;
-        delete[] value;
+          name[i] = Usage::ROT13(value[i]);
+        byte* buffer = new byte[datalen];
+        ::memcpy(buffer, &data[0], datalen);
+        names.push_back(name);
+        buffers.push_back(buffer);
+        sizes.push_back(datalen);
+        bytes += Usage::footprint(name, datalen);
+        this->trim(names, buffers, sizes, bytes, false);
       }
       ::RegCloseKey(handle);
-      ++iter;
     }
+
+    // Publish collected entries.
+    this->trim(names, buffers, sizes, bytes, true);
+    this->publish(names, buffers, sizes);
+    if (errors.empty())
+      return Status();
+    return errors.front();
+  }
+
+
+  /**
+   * @brief Refresh all data from registry.
+   *
+   * Throws WinError on the first failure; use try_update to get partial
+   * results instead.
+   */
+  void
+  update()
+  {
+    std::vector<Status> errors;
+    this->try_update(errors).raise();
+  }
+
+
+  /**
+   * @brief Replace all entries with entries of another source.
+   *
+   * @param source any object which provides size, name, buffer and
+   * buffersize, e.g. Hive or WineRegistry
+   *
+   * The retention policy is applied as well; evicted entries cannot be
+   * reloaded, since reload only queries the live registry.
+   */
+  template <typename Source>
+  void
+  assign(const Source& source)
+  {
+    this->clear();
+    self_fingerprint.clear();
+    self_registry = false;
+    std::vector<wchar_t*> names;
+    std::vector<byte*> buffers;
+    std::vector<size_t> sizes;
+    size_t bytes = 0;
+    const size_t count = source.size();
+    for (size_t index = 0; index < count; ++index)
+    {
+      const wchar_t* name = source.name(index);
+      const size_t namelen = static_cast<size_t>(::lstrlenW(name));
+      const size_t datalen = source.buffersize(index);
+      wchar_t* namecopy = new wchar_t[namelen + 1];
+      ::memcpy(namecopy, name, (namelen + 1) * sizeof(wchar_t));
+      byte* buffercopy = new byte[datalen];
+      if (datalen != 0)
+        ::memcpy(buffercopy, source.buffer(index), datalen);
+      names.push_back(namecopy);
+      buffers.push_back(buffercopy);
+      sizes.push_back(datalen);
+      bytes += Usage::footprint(namecopy, datalen);
+      this->trim(names, buffers, sizes, bytes, false);
+    }
+    this->trim(names, buffers, sizes, bytes, true);
+    this->publish(names, buffers, sizes);
+  }
+
+
+  /**
+   * @brief Check whether the entry was evicted from the working set.
+   *
+   * @param name decoded entry name
+   *
+   * Fingerprints are 64 bit hashes, so false positives are possible but
+   * extremely unlikely; reload reports them as missing values.
+   */
+  bool
+  evicted(const wchar_t* name) const
+  {
+    return std::binary_search(self_fingerprint.begin(),
+                              self_fingerprint.end(),
+                              Sketch::hash(name));
+  }
+
+
+  /**
+   * @brief Retrieve number of evicted entries.
+   */
+  inline size_t
+  evicted_size() const
+  {
+    return self_fingerprint.size();
+  }
+
+
+  /**
+   * @brief Load the evicted entry back from registry.
+   *
+   * @param name decoded entry name
+   * @param index receives index of the entry inside the working set
+   *
+   * The entry stays in the working set until the next update. Fails
+   * with ERROR_NOT_SUPPORTED if entries were taken from another source
+   * via assign.
+   */
+  Status
+  reload(const wchar_t* name,
+         size_t& index)
+  {
+    index = self_count;
+    if (!self_registry)
+      return Status(ERROR_NOT_SUPPORTED, Status::STAGE_QUERY);
+    const uint64_t code = Sketch::hash(name);
+    std::vector<uint64_t>::iterator iter = std::lower_bound(
+      self_fingerprint.begin(), self_fingerprint.end(), code);
+    if ((iter == self_fingerprint.end()) || (*iter != code))
+      return Status(ERROR_FILE_NOT_FOUND, Status::STAGE_QUERY);
+
+    // Value names are stored in ROT13.
+    std::wstring value(name);
+    for (size_t i = 0; i < value.size(); ++i)
+      value[i] = Usage::ROT13(value[i]);
+
+    std::vector<std::wstring> paths;
+    Usage::count_paths(paths);
+    DWORD state = ERROR_FILE_NOT_FOUND;
+    for (size_t keyindex = 0; keyindex < paths.size(); ++keyindex)
+    {
+      HKEY handle;
+      state = ::RegOpenKeyExW(
+        HKEY_CURRENT_USER,
+        paths[keyindex].c_str(),
+        0,
+        KEY_QUERY_VALUE,
+        &handle);
+      if (state != ERROR_SUCCESS)
+        continue;
+      DWORD datalen = 0;
+      DWORD datatype = REG_BINARY;
+      state = ::RegQueryValueExW(handle, value.c_str(), NULL, &datatype, NULL, &datalen);
+      std::vector<byte> data(datalen + 1);
+      if (state == ERROR_SUCCESS)
+        state = ::RegQueryValueExW(handle, value.c_str(), NULL, &datatype, &data[0], &datalen);
+      ::RegCloseKey(handle);
+      if (state != ERROR_SUCCESS)
+        continue;
+
+      // Append entry to the working set.
+      const size_t namelen = value.size();
+      wchar_t** namelist = new wchar_t*[self_count + 1];
+      byte** bufferlist = new byte*[self_count + 1];
+      size_t* sizelist = new size_t[self_count + 1];
+      std::copy(self_name, self_name + self_count, namelist);
+      std::copy(self_buffer, self_buffer + self_count, bufferlist);
+      std::copy(self_buffersize, self_buffersize + self_count, sizelist);
+      namelist[self_count] = new wchar_t[namelen + 1];
+      ::memcpy(namelist[self_count], name, (namelen + 1) * sizeof(wchar_t));
+      bufferlist[self_count] = new byte[datalen];
+      ::memcpy(bufferlist[self_count], &data[0], datalen);
+      sizelist[self_count] = datalen;
+      delete[] self_name;
+      delete[] self_buffer;
+      delete[] self_buffersize;
+      self_name = namelist;
+      self_buffer = bufferlist;
+      self_buffersize = sizelist;
+      index = self_count++;
+      self_fingerprint.erase(iter);
+      return Status();
+    }
+    return Status(state, Status::STAGE_QUERY);
   }
 
 
@@ -411,7 +892,7 @@ public: // CLASS FUNCTIONS
     uint32_t counter;
     const byte* buffer = self_buffer[index];
     const size_t size = self_buffersize[index];
-    Usage::import_data(buffer, size, counter, time);
+    Usage::import_data(buffer, size, counter, time, Usage::layout(size));
     return counter;
   }
 
@@ -425,23 +906,34 @@ public: // CLASS FUNCTIONS
   time(const size_t& index,
        FILETIME& filetime) const
   {
-    time_t time;
+    const uint64_t stamp = this->stamp(index);
+    filetime.dwLowDateTime = static_cast<DWORD>(stamp);
+    filetime.dwHighDateTime = static_cast<DWORD>(stamp >> 32);
+    return static_cast<time_t>(stamp);
+  }
+
+
+  /**
+   * @brief Retrieve time stamp for the given index as FILETIME ticks.
+   * 
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline uint64_t
+  stamp(const size_t& index) const
+  {
+    uint64_t stamp;
     uint32_t counter;
     const byte* buffer = self_buffer[index];
     const size_t size = self_buffersize[index];
-    Usage::import_data(buffer, size, counter, time);
-    filetime.dwLowDateTime = static_cast<DWORD>(time >> 16);
-    filetime.dwHighDateTime = static_cast<DWORD>(time);
-    return time;
+    Usage::import_data(buffer, size, counter, stamp, Usage::layout(size));
+    return stamp;
   }
 
 
 public:
   ~Usage()
   {
-    delete[] self_name;
-    delete[] self_buffer;
-    delete[] self_buffersize;
+    this->clear();
   }
 private:
   Usage()
@@ -450,6 +942,7 @@ private:
     self_name = NULL;
     self_buffer = NULL;
     self_buffersize = NULL;
+    self_registry = true;
     this->update();
   }
   Usage(const Usage&);
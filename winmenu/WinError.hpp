@@ -16,6 +16,101 @@ private:
   char* self_message;
 
 
+private: // PRIVATE FUNCTIONS
+  /**
+   * @brief Spin lock which guards message cache.
+   */
+  static inline LONG volatile&
+  lock()
+  {
+    static LONG volatile self_lock; // zero-initialized before any call
+    return self_lock;
+  }
+
+
+public: // STATIC FUNCTIONS
+  /**
+   * @brief Retrieve system message for the given error code.
+   *
+   * Message is formatted only once per code and then cached, so that the
+   * returned pointer stays valid until the end of the program. Allocation
+   * failures are propagated as exceptions; the lock is released first.
+   */
+  static const char*
+  format(const DWORD& code)
+  {
+    static std::map<DWORD, std::string>* self_cache;
+    while (::InterlockedExchange(&WinError::lock(), 1) != 0)
+      ::Sleep(0);
+    try
+    {
+      if (!self_cache)
+        self_cache = new std::map<DWORD, std::string>;
+    }
+    catch (...)
+    {
+      ::InterlockedExchange(&WinError::lock(), 0);
+      throw;
+    }
+    std::map<DWORD, std::string>::iterator iter = self_cache->find(code);
+    if (iter != self_cache->end())
+    {
+      const char* result = iter->second.c_str();
+      ::InterlockedExchange(&WinError::lock(), 0);
+      return result;
+    }
+
+    // Format message outside of the lock.
+    ::InterlockedExchange(&WinError::lock(), 0);
+    std::string stack;
+    char* buffer = NULL;
+    DWORD flags = FORMAT_MESSAGE_ALLOCATE_BUFFER;
+    flags |= FORMAT_MESSAGE_IGNORE_INSERTS;
+    flags |= FORMAT_MESSAGE_FROM_SYSTEM;
+    WORD lang = MAKELANGID(LANG_ENGLISH, SUBLANG_ENGLISH_US);
+    size_t len = ::FormatMessageA(
+      flags,     // formatting options
+      NULL,      // message source
+      code,      // error code
+      lang,      // language id
+      reinterpret_cast<char*>(&buffer), // pointer to buffer
+      0,         // size of buffer
+      NULL);     // special parameters
+    if ((len == 0) || (buffer == NULL))
+      stack += "WindowsError";
+    else
+    {
+      while ((len > 0) && ((buffer[len-1] <= ' ') || (buffer[len-1] == '.')))
+        buffer[--len] = '\0';
+      try
+      {
+        stack += buffer;
+      }
+      catch (...)
+      {
+        ::LocalFree(buffer);
+        throw;
+      }
+      ::LocalFree(buffer);
+    }
+
+    while (::InterlockedExchange(&WinError::lock(), 1) != 0)
+      ::Sleep(0);
+    try
+    {
+      iter = self_cache->insert(std::make_pair(code, stack)).first;
+    }
+    catch (...)
+    {
+      ::InterlockedExchange(&WinError::lock(), 0);
+      throw;
+    }
+    const char* result = iter->second.c_str();
+    ::InterlockedExchange(&WinError::lock(), 0);
+    return result;
+  }
+
+
 public:
   virtual ~WinError() throw()
   {
@@ -24,7 +119,7 @@ public:
 
 
   WinError(const char* message)
-  : std::runtime_error(NULL)
+  : std::runtime_error("WindowsError")
   {
     self_code = 0;
     if (message)
@@ -35,42 +130,52 @@ public:
 
 
   WinError(const DWORD code)
-  : std::runtime_error(NULL)
+  : std::runtime_error("WindowsError")
   {
     self_code = code;
     self_message = NULL;
   }
 
 
+  WinError(const WinError& other)
+  : std::runtime_error(other)
+  {
+    self_code = other.self_code;
+    if (other.self_message)
+      self_message = ::strdup(other.self_message);
+    else
+      self_message = NULL;
+  }
+
+
+  /**
+   * @brief Retrieve Windows error code or 0 for custom messages.
+   */
+  inline DWORD
+  code() const
+  {
+    return self_code;
+  }
+
+
   virtual const char*
   what() const throw()
   {
-    std::string stack;
-    char* buffer = NULL;
-    DWORD code = self_code;
-    DWORD flags = FORMAT_MESSAGE_ALLOCATE_BUFFER;
-    flags |= FORMAT_MESSAGE_IGNORE_INSERTS;
-    flags |= FORMAT_MESSAGE_FROM_SYSTEM;
-    WORD lang = MAKELANGID(LANG_ENGLISH, SUBLANG_ENGLISH_US);
-    size_t len = ::FormatMessageA(
-      flags,     // formatting options
-      NULL,      // message source
-      code,      // error code
-      lang,      // language id
-      buffer,    // pointer to buffer
-      0,         // size of buffer
-      NULL);     // special parameters
-    if (len == 0)
-      stack += "WindowsError";
-    else
+    if (self_message)
+      return self_message;
+    try
     {
-      while ((len > 0) && ((buffer[len-1] <= ' ') || (buffer[len-1] == '.')))
-        buffer[--len] = '\0';
-      stack += buffer;
-      ::LocalFree(buffer);
+      return WinError::format(self_code);
+    }
+    catch (...)
+    {
+      return "WindowsError";
     }
-    return stack.c_str();
   }
+
+
+private:
+  WinError& operator=(const WinError&);
 };
 
 
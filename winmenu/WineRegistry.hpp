@@ -0,0 +1,393 @@
+/**
+ * @author    Dmitry Selyutin
+ * @copyright GNU General Public License v3.0+
+ */
+
+#ifndef WINAPPUSAGE_WINEREGISTRY_HPP
+#define WINAPPUSAGE_WINEREGISTRY_HPP
+#include "config.hpp"
+#include "stdint.hpp"
+#include "Status.hpp"
+#include "Usage.hpp"
+#include "MappedFile.hpp"
+namespace winmenu {
+
+
+/**
+ * @brief Reader of UserAssist entries from the Wine user.reg file.
+ *
+ * The file is memory-mapped and scanned for the UserAssist key names
+ * only; all other sections are skipped without splitting them into lines.
+ * Decoded names and value data are stored in two arenas, like Encoder
+ * does, and are available through the same accessors as Usage. Use
+ * Usage::assign to feed them into the Usage singleton.
+ */
+class WineRegistry
+{
+private: // PRIVATE MEMBERS
+  std::vector<wchar_t> self_name;
+  std::vector<byte> self_data;
+  std::vector<size_t> self_nameoffset;
+  std::vector<size_t> self_dataoffset;
+
+
+private: // STATIC FUNCTIONS
+  /**
+   * @brief Retrieve value of the hex digit or 0xFF for other characters.
+   */
+  static inline byte
+  nibble(const char& chr)
+  {
+    const byte digit = static_cast<byte>(static_cast<byte>(chr) - '0');
+    if (digit < 10)
+      return digit;
+    const byte letter = static_cast<byte>((static_cast<byte>(chr) | 0x20) - 'a');
+    if (letter < 6)
+      return static_cast<byte>(letter + 10);
+    return 0xFF;
+  }
+
+
+  /**
+   * @brief Find the string in [head, tail).
+   */
+  static const char*
+  find(const char* head,
+       const char* tail,
+       const char* str,
+       const size_t& size)
+  {
+    while ((tail - head) >= static_cast<ptrdiff_t>(size))
+    {
+      const void* iter = ::memchr(head, str[0], (tail - head) - size + 1);
+      if (iter == NULL)
+        return NULL;
+      head = static_cast<const char*>(iter);
+      if (::memcmp(head, str, size) == 0)
+        return head;
+      ++head;
+    }
+    return NULL;
+  }
+
+
+  /**
+   * @brief Compare strings ignoring case of ASCII letters.
+   */
+  static bool
+  equal(const char* lhs,
+        const char* rhs,
+        const size_t& size)
+  {
+    for (size_t i = 0; i < size; ++i)
+    {
+      char lchr = lhs[i];
+      char rchr = rhs[i];
+      if ((lchr >= 'A') && (lchr <= 'Z'))
+        lchr += ('a' - 'A');
+      if ((rchr >= 'A') && (rchr <= 'Z'))
+        rchr += ('a' - 'A');
+      if (lchr != rchr)
+        return false;
+    }
+    return true;
+  }
+
+
+private: // PRIVATE FUNCTIONS
+  /**
+   * @brief Decode quoted value name and append it to the name arena.
+   *
+   * @param iter points to the opening quote; moved past the closing one
+   * @return false if the name is malformed
+   */
+  bool
+  decode_name(const char*& iter,
+              const char* tail)
+  {
+    const size_t offset = self_name.size();
+    for (++iter; iter < tail; ++iter)
+    {
+      wchar_t chr = static_cast<byte>(*iter);
+      if (chr == '"')
+      {
+        ++iter;
+        self_name.push_back(0);
+        return true;
+      }
+      if ((chr == '\n') || (chr == '\r'))
+        break;
+      if ((chr == '\\') && ((iter + 1) < tail))
+      {
+        chr = static_cast<byte>(*++iter);
+        if (chr == 'x')
+        {
+          // Unicode character as up to 4 hex digits.
+          chr = 0;
+          for (size_t i = 0; (i < 4) && ((iter + 1) < tail); ++i)
+          {
+            const byte code = WineRegistry::nibble(iter[1]);
+            if (code == 0xFF)
+              break;
+            chr = static_cast<wchar_t>((chr << 4) | code);
+            ++iter;
+          }
+        }
+        else if ((chr >= '0') && (chr <= '7'))
+        {
+          chr -= '0';
+          for (size_t i = 1; (i < 3) && ((iter + 1) < tail); ++i)
+          {
+            if ((iter[1] < '0') || (iter[1] > '7'))
+              break;
+            chr = static_cast<wchar_t>((chr << 3) | (*++iter - '0'));
+          }
+        }
+        else if (chr == 'n')
+          chr = '\n';
+        else if (chr == 'r')
+          chr = '\r';
+        else if (chr == 't')
+          chr = '\t';
+      }
+      self_name.push_back(Usage::ROT13(chr));
+    }
+    self_name.resize(offset);
+    return false;
+  }
+
+
+  /**
+   * @brief Decode "hex:" list and append bytes to the data arena.
+   *
+   * Both digits of the pair are decoded before validation, so that the
+   * common case takes a single check; separators and line continuations
+   * are skipped in the same pass.
+   */
+  void
+  decode_hex(const char*& iter,
+             const char* tail)
+  {
+    while ((tail - iter) >= 2)
+    {
+      const byte hpart = WineRegistry::nibble(iter[0]);
+      const byte lpart = WineRegistry::nibble(iter[1]);
+      if (((hpart | lpart) & 0xF0) == 0)
+      {
+        self_data.push_back(static_cast<byte>((hpart << 4) | lpart));
+        iter += 2;
+        if ((iter < tail) && (*iter == ','))
+        {
+          ++iter;
+          continue;
+        }
+      }
+      if ((iter < tail) && (*iter == '\\'))
+      {
+        // Line continuation.
+        ++iter;
+        while ((iter < tail) && ((*iter == '\r') || (*iter == '\n') || (*iter == ' ') || (*iter == '\t')))
+          ++iter;
+        continue;
+      }
+      break;
+    }
+    while ((iter < tail) && (*iter != '\n'))
+      ++iter;
+  }
+
+
+  /**
+   * @brief Parse values of the single Count section.
+   *
+   * @param iter points to the first line after the key header
+   */
+  void
+  parse_section(const char*& iter,
+                const char* tail)
+  {
+    while (iter < tail)
+    {
+      if (*iter == '[')
+        return;
+      if (*iter == '"')
+      {
+        const size_t nameoffset = self_name.size();
+        const size_t dataoffset = self_data.size();
+        if (this->decode_name(iter, tail)
+        && ((tail - iter) >= 5)
+        && (::memcmp(iter, "=hex:", 5) == 0))
+        {
+          iter += 5;
+          this->decode_hex(iter, tail);
+          self_nameoffset.push_back(nameoffset);
+          self_dataoffset.push_back(dataoffset);
+        }
+        else
+          self_name.resize(nameoffset);
+      }
+      const void* next = ::memchr(iter, '\n', tail - iter);
+      iter = (next ? (static_cast<const char*>(next) + 1) : tail);
+    }
+  }
+
+
+public: // CLASS FUNCTIONS
+  WineRegistry()
+  {
+  }
+
+
+  /**
+   * @brief Parse UserAssist entries from the given user.reg file.
+   */
+  Status
+  open(const wchar_t* path)
+  {
+    this->clear();
+    MappedFile file;
+    Status status = file.open(path);
+    if (!status.ok())
+      return status;
+    const char* head = reinterpret_cast<const char*>(file.data());
+    const char* tail = (head + file.size());
+    if (head == NULL)
+      return Status();
+    if ((file.size() < 8) || (::memcmp(head, "WINE REG", 8) != 0))
+      return Status(ERROR_BADDB, Status::STAGE_DECODE);
+
+    // Skip directly to UserAssist keys.
+    const char prefix[] = "Software\\\\Microsoft\\\\Windows\\\\CurrentVersion\\\\Explorer\\\\";
+    const char anchor[] = "UserAssist\\\\";
+    const char suffix[] = "\\\\Count]";
+    const size_t prefixsize = (sizeof(prefix) - 1);
+    const size_t anchorsize = (sizeof(anchor) - 1);
+    const size_t suffixsize = (sizeof(suffix) - 1);
+    const char* iter = head;
+    while ((iter = WineRegistry::find(iter, tail, anchor, anchorsize)) != NULL)
+    {
+      const char* key = (iter - prefixsize - 1);
+      iter += anchorsize;
+      if ((key < head)
+      || (key[0] != '[')
+      || ((key != head) && (key[-1] != '\n'))
+      || !WineRegistry::equal(key + 1, prefix, prefixsize))
+        continue;
+      const void* eol = ::memchr(iter, '\n', tail - iter);
+      const char* line = (eol ? static_cast<const char*>(eol) : tail);
+      const char* close = static_cast<const char*>(::memchr(iter, ']', line - iter));
+      if ((close == NULL)
+      || ((close + 1 - iter) < static_cast<ptrdiff_t>(suffixsize))
+      || !WineRegistry::equal(close + 1 - suffixsize, suffix, suffixsize))
+        continue;
+      iter = (eol ? (line + 1) : tail);
+      this->parse_section(iter, tail);
+    }
+    return Status();
+  }
+
+
+  void
+  clear()
+  {
+    self_name.clear();
+    self_data.clear();
+    self_nameoffset.clear();
+    self_dataoffset.clear();
+  }
+
+
+  inline size_t
+  size() const
+  {
+    return self_nameoffset.size();
+  }
+
+
+  /**
+   * @brief Retrieve decoded name for the given index.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline const wchar_t*
+  name(const size_t& index) const
+  {
+    return &self_name[self_nameoffset[index]];
+  }
+
+
+  /**
+   * @brief Retrieve buffer for the given index.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline const byte*
+  buffer(const size_t& index) const
+  {
+    if (this->buffersize(index) == 0)
+      return NULL;
+    return &self_data[self_dataoffset[index]];
+  }
+
+
+  inline size_t
+  buffersize(const size_t& index) const
+  {
+    const size_t tail = ((index + 1) < self_dataoffset.size())
+      ? self_dataoffset[index + 1]
+      : self_data.size();
+    return (tail - self_dataoffset[index]);
+  }
+
+
+  /**
+   * @brief Retrieve counter for the given index.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline int32_t
+  counter(const size_t& index) const
+  {
+    time_t time;
+    uint32_t counter;
+    const size_t size = this->buffersize(index);
+    Usage::import_data(this->buffer(index), size, counter, time, Usage::layout(size));
+    return counter;
+  }
+
+
+  /**
+   * @brief Retrieve time stamp for the given index.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline time_t
+  time(const size_t& index,
+       FILETIME& filetime) const
+  {
+    const uint64_t stamp = this->stamp(index);
+    filetime.dwLowDateTime = static_cast<DWORD>(stamp);
+    filetime.dwHighDateTime = static_cast<DWORD>(stamp >> 32);
+    return static_cast<time_t>(stamp);
+  }
+
+
+  /**
+   * @brief Retrieve time stamp for the given index as FILETIME ticks.
+   *
+   * @WARNING This function doesn't check index leaving it up to user.
+   */
+  inline uint64_t
+  stamp(const size_t& index) const
+  {
+    uint64_t stamp;
+    uint32_t counter;
+    const size_t size = this->buffersize(index);
+    Usage::import_data(this->buffer(index), size, counter, stamp, Usage::layout(size));
+    return stamp;
+  }
+};
+
+
+} // namespace winmenu
+#endif // WINAPPUSAGE_WINEREGISTRY_HPP
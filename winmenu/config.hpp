@@ -12,12 +12,15 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <limits.h>
+#include <math.h>
 #include <string.h>
 #include <time.h>
+#include <wchar.h>
 
 // C++ include
 #include <algorithm>
 #include <iostream>
+#include <map>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -27,4 +30,14 @@
 #include <windows.h>
 
 
+// POSIX include (Winelib builds; winegcc predefines _WIN32 as well)
+#if defined(__WINE__) || !defined(_WIN32)
+  #define WINAPPUSAGE_POSIX
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+
 #endif // CONFIG_HPP